@@ -19,6 +19,25 @@
 #include <linux/dcache.h>
 #include <linux/mount.h>
 #include <linux/fs_struct.h>
+#include <linux/bitmap.h>
+#include <linux/search.h>
+#include <linux/anon_inodes.h>
+#include <linux/cred.h>
+#include <linux/workqueue.h>
+#include <linux/wait.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/aio.h>
+#include <linux/mmu_context.h>
+#include <linux/textsearch.h>
+#include <linux/ctype.h>
+#include <linux/hash.h>
+#include <linux/jhash.h>
+#include <linux/sort.h>
+#include <linux/log2.h>
+#ifdef CONFIG_X86
+#include <asm/i387.h>
+#endif
 #include "read_write.h"
 #include "mount.h"
 
@@ -1023,11 +1042,11 @@ SYSCALL_DEFINE4(sendfile64, int, out_fd, int, in_fd, loff_t __user *, offset, si
 		* | concat patterns
  */
 
+/* results of match_pathname, both can be set */
 enum search_matched {
-  SEARCH_MATCH_FAILURE,
-  SEARCH_MATCH_PARTIAL,
-  SEARCH_MATCH_SUCCESS,
-  SEARCH_MATCH_OVERFLOW,
+  SEARCH_MATCH_FAILURE = 0,
+  SEARCH_MATCH_SUCCESS = 1<<0,
+  SEARCH_MATCH_PARTIAL = 1<<1, /* the pattern continues below this directory */
 };
 
 static const char *strchrskip (const char *s, int c)
@@ -1043,88 +1062,877 @@ static int ispattern (const char *pattern)
 	if (*pattern != '/') return 1;
 	for (; *pattern; pattern += 1) {
 		char c = *pattern;
-		if (c == '*' || c == '?' || c == '|')
+		if (c == '*' || c == '?' || c == '[' || c == '|')
 			return 1;
 	}
 	return 0;
 }
 
-#define is_filename(c)  ((c) != '/' && (c) != '\0')
-static enum search_matched __match_pathname (int n, const char *pathname, const char *pattern, int flags)
+/*
+ * The pattern is compiled once per search into a position automaton: one
+ * position per pattern character, the '|' alternatives laid out one after
+ * the other, each closed by SEARCH_OP_END.  A match state is the bitmap of
+ * positions reached so far, so matching a path is linear in its length
+ * whatever the number of '*' and alternatives.
+ *
+ * Alternatives starting with '/' are anchored at the root, the others may
+ * start after any '/' of the path.  With SEARCH_PERIOD a leading '.' of a
+ * name is only matched by a '.' that starts a component of the pattern, as
+ * with FNM_PERIOD: not by a wildcard, nor by a '.' after one that took
+ * nothing.
+ *
+ * A "**" component takes two positions, GLOBSTAR where a component may
+ * start and GLOBSTAR_IN within one, and stands for any number of whole
+ * components.  Only where it is live does an anchored pattern need to go
+ * deeper than its literal components say.  As with bash's globstar, a
+ * trailing "**" after a '/' also takes none: "/src" followed by it
+ * matches src itself.
+ *
+ * A bracket expression is one position with the set of bytes it matches.
+ * With SEARCH_ICASE characters are kept folded to lower case and sets
+ * hold both cases, only ASCII letters fold: names are not Latin-1.
+ */
+enum search_op {
+	SEARCH_OP_CHAR,  /* the character in c[] */
+	SEARCH_OP_ANY,   /* '?', one filename character or none */
+	SEARCH_OP_STAR,  /* '*', any number of filename characters */
+	SEARCH_OP_SLASH, /* '/' */
+	SEARCH_OP_CLASS, /* '[...]', one of the filename characters in set[cls[]] */
+	SEARCH_OP_GLOBSTAR,    /* "**" at the start of a component, or past it: see search_closure */
+	SEARCH_OP_GLOBSTAR_IN, /* second '*' of "**", within a component it takes */
+	SEARCH_OP_END,   /* end of an alternative */
+};
+
+#define SEARCH_SET_LONGS  BITS_TO_LONGS(256)
+#define search_fold(c)  ((c) >= 'A' && (c) <= 'Z' ? (c)-'A'+'a' : (c))
+
+/*
+ * When every alternative is a '*' and a literal, as in "*.c|*.h|*.cc",
+ * a name matches if it ends with one of the literals.  They are laid out
+ * reversed in a trie whose edges are hashed, so that a name is classified
+ * walking back from its end once, whatever the number of alternatives.
+ */
+struct search_suffix {
+	unsigned int bits; /* of the edge table */
+	u32 *key;      /* (node<<8 | c)+1 of an edge, 0 for a free slot */
+	u16 *child;    /* where the edge goes */
+	unsigned char *final; /* per node: a literal ends there */
+};
+
+/* alternatives whose literals search_filter looks for, more are not filtered */
+#define SEARCH_FILTER_MAX  4
+
+struct search_pattern {
+	int npos;
+	int period; /* SEARCH_PERIOD */
+	int icase;  /* SEARCH_ICASE */
+	unsigned long (*set)[SEARCH_SET_LONGS]; /* of the bracket expressions */
+	u16 *cls; /* per position: its bracket expression in set */
+	struct search_regex *regex; /* SEARCH_REGEX, for the names the glob matches */
+	struct search_suffix *suffix; /* NULL unless a suffix set */
+	int nlits; /* 0 when some alternative has no literal in its last component */
+	struct {
+		int pos; /* in c[] */
+		int len;
+	} lit[SEARCH_FILTER_MAX]; /* longest run of characters of each last component */
+	unsigned long *start;   /* closed start state at the root */
+	unsigned long *restart; /* entered after every '/' */
+	unsigned long *accept;  /* SEARCH_OP_END */
+	unsigned long *slash;   /* SEARCH_OP_SLASH and SEARCH_OP_GLOBSTAR_IN, go on after a '/' */
+	unsigned char *op;
+	unsigned char *c;
+};
+
+#define search_pattern_words(npos)  BITS_TO_LONGS((npos)+1)
+
+/* Follow the positions that can match nothing. */
+static void search_closure (const struct search_pattern *p, unsigned long *state)
 {
-	//printk("__match_pathname(%d, '%s', '%s', %d)\n", n, pathname, pattern, flags);
-	if (n >= 8) return SEARCH_MATCH_OVERFLOW;
-	while (1) {
-		switch (pattern[0]) {
-			case '\0':
-				return pathname[0] == '\0' ? SEARCH_MATCH_SUCCESS : SEARCH_MATCH_FAILURE;
+	int i;
+
+	for_each_set_bit(i, state, p->npos) {
+		if (p->op[i] == SEARCH_OP_STAR || p->op[i] == SEARCH_OP_ANY)
+			__set_bit(i+1, state);
+		else if (p->op[i] == SEARCH_OP_GLOBSTAR && p->op[i+2] == SEARCH_OP_SLASH)
+			__set_bit(i+3, state); /* no component, past "**" + "/" */
+		else if (p->op[i] == SEARCH_OP_GLOBSTAR_IN && p->op[i+1] == SEARCH_OP_END)
+			__set_bit(i+1, state); /* a trailing "**" has taken a name */
+	}
+}
+
+/* Is every alternative a '*' followed by plain characters? */
+static int search_suffix_set (const char *pattern)
+{
+	const char *c = pattern;
+
+	for (;;) {
+		if (*c != '*')
+			return 0;
+		for (c++; *c && *c != '|'; c++) {
+			if (*c == '*' || *c == '?' || *c == '[' || *c == '/')
+				return 0;
+		}
+		if (!*c)
+			return 1;
+		c++;
+	}
+}
+
+/* The node the edge from node by c leads to, -1 if none; *slot is where it is or would go. */
+static int search_suffix_edge (const struct search_suffix *s, int node, unsigned char c, u32 *slot)
+{
+	u32 key = ((u32) node << 8 | c) + 1;
+	u32 mask = (1U << s->bits) - 1;
+	u32 i;
+
+	for (i = hash_32(key, s->bits); s->key[i]; i = (i+1) & mask) {
+		if (s->key[i] == key) {
+			*slot = i;
+			return s->child[i];
+		}
+	}
+	*slot = i;
+	return -1;
+}
+
+/* Lay the literals of a suffix set out reversed in s, which has room for them. */
+static void search_suffix_build (struct search_suffix *s, const char *pattern, int icase)
+{
+	const char *alt = pattern;
+	int nodes = 1;
+
+	while (alt) {
+		const char *end = alt + strcspn(alt, "|");
+		const char *c;
+		int node = 0;
+
+		for (c = end; c > alt+1; c--) {
+			unsigned char ch = icase ? search_fold(c[-1]) : c[-1];
+			u32 slot;
+			int next = search_suffix_edge(s, node, ch, &slot);
+
+			if (next < 0) {
+				next = nodes++;
+				s->key[slot] = ((u32) node << 8 | ch) + 1;
+				s->child[slot] = next;
+			}
+			node = next;
+		}
+		s->final[node] = 1;
+		alt = *end ? end+1 : NULL;
+	}
+}
+
+/* Does name end with a literal of the suffix set, the '*' before it matching the rest? */
+static int search_suffix_match (const struct search_pattern *p, const char *name)
+{
+	const struct search_suffix *s = p->suffix;
+	int i = strlen(name);
+	int node = 0;
+	u32 slot;
+
+	if (p->period && name[0] == '.')
+		return 0; /* every literal follows a '*', none starts the name */
+	for (;;) {
+		if (s->final[node])
+			return 1;
+		if (i == 0)
+			return 0;
+		i -= 1;
+		node = search_suffix_edge(s, node, p->icase ? search_fold(name[i]) : name[i], &slot);
+		if (node < 0)
+			return 0;
+	}
+}
+
+/*
+ * A name can only match an alternative if it contains the longest literal
+ * of its last component.  Find those for search_filter.
+ */
+static void search_literals (struct search_pattern *p)
+{
+	int best = -1;
+	int bestlen = 0;
+	int i, len;
+
+	for (i = 0; i < p->npos; i++) {
+		switch (p->op[i]) {
+			case SEARCH_OP_SLASH:
+				best = -1;
+				bestlen = 0;
+				break;
+			case SEARCH_OP_CHAR:
+				for (len = 0; p->op[i+len] == SEARCH_OP_CHAR; len++)
+					;
+				if (len > bestlen) {
+					best = i;
+					bestlen = len;
+				}
+				i += len-1;
+				break;
+			case SEARCH_OP_END:
+				if (!bestlen || p->nlits == SEARCH_FILTER_MAX) {
+					p->nlits = 0;
+					return;
+				}
+				p->lit[p->nlits].pos = best;
+				p->lit[p->nlits].len = bestlen;
+				p->nlits += 1;
+				best = -1;
+				bestlen = 0;
+				break;
+		}
+	}
+}
+
+/* POSIX classes for "[[:alpha:]]", of the ASCII characters only */
+static const struct {
+	const char *name;
+	unsigned char mask; /* _U, _L, ... of linux/ctype.h */
+} search_classes[] = {
+	{ "alnum",  _U|_L|_D },
+	{ "alpha",  _U|_L },
+	{ "blank",  0 }, /* ' ' and '\t' */
+	{ "cntrl",  _C },
+	{ "digit",  _D },
+	{ "graph",  _P|_U|_L|_D },
+	{ "lower",  _L },
+	{ "print",  _P|_U|_L|_D|_SP },
+	{ "punct",  _P },
+	{ "space",  _S },
+	{ "upper",  _U },
+	{ "xdigit", _D|_X },
+};
+
+/* Add "[:name:]", at c, to set.  Its length, or 0 if it is not one. */
+static int search_class (const char *c, unsigned long *set)
+{
+	const char *end;
+	int i, k;
+
+	for (end = c+2; *end && *end != '|' && !(end[0] == ':' && end[1] == ']'); end++)
+		;
+	if (*end != ':')
+		return 0;
+	for (k = 0; k < ARRAY_SIZE(search_classes); k++) {
+		if (strlen(search_classes[k].name) == end-c-2 && strncmp(search_classes[k].name, c+2, end-c-2) == 0)
+			break;
+	}
+	if (k == ARRAY_SIZE(search_classes))
+		return 0;
+	for (i = 0; i < 128; i++) {
+		if (search_classes[k].mask ? __ismask(i) & search_classes[k].mask : i == ' ' || i == '\t')
+			__set_bit(i, set);
+	}
+	return end+2-c;
+}
+
+/*
+ * Parse the bracket expression at pattern into set: "[abc]", "[a-z]",
+ * "[[:digit:]]", negated with '!' or '^'; a ']' right after the opening
+ * bracket is an ordinary one.  '|' still separates alternatives, so
+ * cannot be in a set.  The length of the expression, 0 if it is not
+ * closed, and then the '[' is an ordinary character as with fnmatch(3).
+ */
+static int search_bracket (const char *pattern, unsigned long *set, int icase)
+{
+	const char *c = pattern+1;
+	int negate = 0;
+	int i;
+
+	if (*c == '!' || *c == '^') {
+		negate = 1;
+		c++;
+	}
+	bitmap_zero(set, 256);
+	do {
+		unsigned char lo = *c;
+		unsigned char hi;
+
+		if (!*c || *c == '|')
+			return 0;
+		if (c[0] == '[' && c[1] == ':') {
+			int len = search_class(c, set);
+
+			if (!len)
+				return 0;
+			c += len;
+			continue;
+		}
+		c++;
+		if (c[0] == '-' && c[1] && c[1] != ']' && c[1] != '|') {
+			hi = c[1];
+			c += 2;
+		} else {
+			hi = lo;
+		}
+		for (i = lo; i <= hi; i++)
+			__set_bit(i, set);
+	} while (*c != ']');
+
+	if (icase) {
+		for (i = 'a'; i <= 'z'; i++) {
+			if (test_bit(i, set) || test_bit(i-'a'+'A', set)) {
+				__set_bit(i, set);
+				__set_bit(i-'a'+'A', set);
+			}
+		}
+	}
+	if (negate)
+		bitmap_complement(set, set, 256);
+	__clear_bit('/', set);
+	__clear_bit('\0', set);
+	return c+1-pattern;
+}
+
+/*
+ * SEARCH_REGEX: the pattern is an extended regular expression that the
+ * names of the entries are searched for, anchored only by '^' and '$'.
+ * There are '.', bracket expressions as for globs, '(', ')', '|', '*',
+ * '+', '?' and '\' to quote; not intervals nor backreferences.  It is
+ * compiled once into a Thompson NFA, which each walker turns lazily
+ * into a DFA, see search_regex_match.
+ */
+enum search_nop {
+	SEARCH_NOP_CHAR,  /* c, then out */
+	SEARCH_NOP_ANY,   /* any byte, then out */
+	SEARCH_NOP_SET,   /* a byte of set[], then out */
+	SEARCH_NOP_SPLIT, /* out and out1 */
+	SEARCH_NOP_JUMP,  /* out */
+	SEARCH_NOP_BOL,   /* out, at the start of the name only */
+	SEARCH_NOP_EOL,   /* out, at the end of the name only */
+	SEARCH_NOP_MATCH,
+};
+
+struct search_nstate {
+	unsigned char op;
+	unsigned char c;
+	u16 set;
+	int out;
+	int out1;
+};
+
+struct search_regex {
+	int nstates;
+	int start;
+	int icase;
+	struct search_nstate *st;
+	unsigned long (*set)[SEARCH_SET_LONGS];
+	int nsets;
+};
+
+/* nesting of '(' allowed, the parser recurses */
+#define SEARCH_REGEX_DEPTH  32
+
+/* a piece of the NFA being built: where it starts, and the outs left to patch, see search_rslot */
+struct search_frag {
+	int start;
+	int out;
+};
+
+struct search_rparse {
+	struct search_regex *r;
+	const char *c;
+	int depth;
+};
+
+/*
+ * Outs are numbered 2*state, and 2*state+1 for out1.  Until patched an
+ * out holds the number of the next one to patch with it, or -1.
+ */
+static int *search_rslot (struct search_regex *r, int slot)
+{
+	return slot & 1 ? &r->st[slot>>1].out1 : &r->st[slot>>1].out;
+}
+
+static void search_rpatch (struct search_regex *r, int list, int target)
+{
+	while (list >= 0) {
+		int *slot = search_rslot(r, list);
+
+		list = *slot;
+		*slot = target;
+	}
+}
+
+static int search_rappend (struct search_regex *r, int list, int tail)
+{
+	int last = list;
+
+	if (list < 0)
+		return tail;
+	while (*search_rslot(r, last) >= 0)
+		last = *search_rslot(r, last);
+	*search_rslot(r, last) = tail;
+	return list;
+}
+
+static int search_rstate (struct search_regex *r, int op)
+{
+	int s = r->nstates++;
+
+	r->st[s].op = op;
+	r->st[s].out = r->st[s].out1 = -1;
+	return s;
+}
+
+static int search_ralt (struct search_rparse *rp, struct search_frag *f);
+
+static int search_ratom (struct search_rparse *rp, struct search_frag *f)
+{
+	struct search_regex *r = rp->r;
+	const char *c = rp->c;
+	int status;
+	int len;
+	int s;
+
+	switch (*c) {
+		case '(':
+			if (++rp->depth > SEARCH_REGEX_DEPTH)
+				return -EINVAL;
+			rp->c++;
+			status = search_ralt(rp, f);
+			if (status)
+				return status;
+			if (*rp->c != ')')
+				return -EINVAL;
+			rp->c++;
+			rp->depth--;
+			return 0;
+		case '[':
+			len = search_bracket(c, r->set[r->nsets], r->icase);
+			if (!len)
+				return -EINVAL;
+			s = search_rstate(r, SEARCH_NOP_SET);
+			r->st[s].set = r->nsets++;
+			rp->c += len;
+			break;
+		case '.':
+			s = search_rstate(r, SEARCH_NOP_ANY);
+			rp->c++;
+			break;
+		case '^':
+			s = search_rstate(r, SEARCH_NOP_BOL);
+			rp->c++;
+			break;
+		case '$':
+			s = search_rstate(r, SEARCH_NOP_EOL);
+			rp->c++;
+			break;
+		case '\\':
+			if (!c[1])
+				return -EINVAL;
+			s = search_rstate(r, SEARCH_NOP_CHAR);
+			r->st[s].c = r->icase ? search_fold(c[1]) : c[1];
+			rp->c += 2;
+			break;
+		case '*':
+		case '+':
+		case '?':
+		case '{':
+			return -EINVAL; /* nothing to repeat, or an interval */
+		default:
+			s = search_rstate(r, SEARCH_NOP_CHAR);
+			r->st[s].c = r->icase ? search_fold(*c) : *c;
+			rp->c++;
+			break;
+	}
+	f->start = s;
+	f->out = 2*s;
+	return 0;
+}
+
+static int search_rrepeat (struct search_rparse *rp, struct search_frag *f)
+{
+	struct search_regex *r = rp->r;
+	int status;
+	int s;
+
+	status = search_ratom(rp, f);
+	if (status)
+		return status;
+	for (; *rp->c == '*' || *rp->c == '+' || *rp->c == '?'; rp->c++) {
+		s = search_rstate(r, SEARCH_NOP_SPLIT);
+		r->st[s].out = f->start;
+		switch (*rp->c) {
 			case '*':
-				do {
-					enum search_matched result = __match_pathname(n+1, pathname, pattern+1, flags);
-					if (result != SEARCH_MATCH_FAILURE)
-						return result;
-					pathname += 1;
-				} while (is_filename(*(pathname-1)));
-				return SEARCH_MATCH_FAILURE;
+				search_rpatch(r, f->out, s);
+				f->start = s;
+				f->out = 2*s+1;
+				break;
+			case '+':
+				search_rpatch(r, f->out, s);
+				f->out = 2*s+1;
+				break;
 			case '?':
-				if (is_filename(*pathname)) {
-					enum search_matched result = __match_pathname(n+1, pathname+1, pattern+1, flags);
-					if (result != SEARCH_MATCH_FAILURE)
-						return result;
-				}
-				/* else ? is skipped */
+				f->start = s;
+				f->out = search_rappend(r, f->out, 2*s+1);
 				break;
-			case '[':
-				return SEARCH_MATCH_FAILURE;;
+		}
+	}
+	return 0;
+}
+
+static int search_rconcat (struct search_rparse *rp, struct search_frag *f)
+{
+	struct search_regex *r = rp->r;
+	int status;
+
+	f->start = -1;
+	while (*rp->c && *rp->c != '|' && *rp->c != ')') {
+		struct search_frag g;
+
+		status = search_rrepeat(rp, &g);
+		if (status)
+			return status;
+		if (f->start < 0) {
+			*f = g;
+		} else {
+			search_rpatch(r, f->out, g.start);
+			f->out = g.out;
+		}
+	}
+	if (f->start < 0) {
+		int s = search_rstate(r, SEARCH_NOP_JUMP);
+
+		f->start = s;
+		f->out = 2*s;
+	}
+	return 0;
+}
+
+static int search_ralt (struct search_rparse *rp, struct search_frag *f)
+{
+	struct search_regex *r = rp->r;
+	int status;
+
+	status = search_rconcat(rp, f);
+	while (status == 0 && *rp->c == '|') {
+		struct search_frag g;
+		int s;
+
+		rp->c++;
+		status = search_rconcat(rp, &g);
+		if (status)
+			break;
+		s = search_rstate(r, SEARCH_NOP_SPLIT);
+		r->st[s].out = f->start;
+		r->st[s].out1 = g.start;
+		f->start = s;
+		f->out = search_rappend(r, f->out, g.out);
+	}
+	return status;
+}
+
+static struct search_regex *search_regex_compile (const char *pattern, int flags)
+{
+	struct search_rparse rp;
+	struct search_regex *r;
+	struct search_frag f;
+	size_t len = strlen(pattern);
+	int nsets = 0;
+	int status;
+	const char *c;
+
+	/* a state per atom, repetition, '|' and empty alternative at most */
+	for (c = pattern; *c; c++)
+		nsets += *c == '[';
+	r = kzalloc(sizeof(struct search_regex) + nsets*sizeof(*r->set) + (2*len+2)*sizeof(struct search_nstate), GFP_KERNEL);
+	if (!r)
+		return ERR_PTR(-ENOMEM);
+	r->icase = !!(flags & SEARCH_ICASE);
+	r->set = (unsigned long (*)[SEARCH_SET_LONGS]) (r+1);
+	r->st = (struct search_nstate *) (r->set + nsets);
+
+	rp.r = r;
+	rp.c = pattern;
+	rp.depth = 0;
+	status = search_ralt(&rp, &f);
+	if (status == 0 && *rp.c)
+		status = -EINVAL; /* a ')' too many */
+	if (status) {
+		kfree(r);
+		return ERR_PTR(status);
+	}
+	search_rpatch(r, f.out, search_rstate(r, SEARCH_NOP_MATCH));
+	r->start = f.start;
+	return r;
+}
+
+static struct search_pattern *search_compile (const char *pattern, int flags)
+{
+	DECLARE_BITMAP(scratch, 256);
+	struct search_pattern *p;
+	size_t words;
+	size_t extra = 0;
+	unsigned int bits = 0;
+	const char *c;
+	int icase = !!(flags & SEARCH_ICASE);
+	int npos = 1;
+	int nsets = 0;
+	int anchored;
+	int suffix;
+	int len;
+	int i;
+
+	if (flags & SEARCH_REGEX) {
+		struct search_regex *r = search_regex_compile(pattern, flags);
+
+		if (IS_ERR(r))
+			return ERR_CAST(r);
+		/* walk everything, the regex has the last word on names */
+		p = search_compile("*", flags & ~SEARCH_REGEX);
+		if (IS_ERR(p))
+			kfree(r);
+		else
+			p->regex = r;
+		return p;
+	}
+
+	for (c = pattern; *c; c++) {
+		len = *c == '[' ? search_bracket(c, scratch, icase) : 0;
+		if (len) {
+			nsets += 1;
+			c += len-1;
+		}
+		npos += 1; /* each '|' becomes the SEARCH_OP_END of its alternative */
+	}
+
+	/* a trie node per literal character at most, the edge table at most half full */
+	suffix = search_suffix_set(pattern);
+	if (suffix) {
+		bits = ilog2(roundup_pow_of_two(2*npos));
+		extra = sizeof(struct search_suffix) + ((sizeof(u32)+sizeof(u16)) << bits) + npos;
+	}
+
+	/* bitmaps, sets, the suffix edges, cls, its final, op, c: in order of alignment */
+	words = search_pattern_words(npos);
+	p = kzalloc(sizeof(struct search_pattern) + 4*words*sizeof(long) + nsets*sizeof(*p->set) + extra + npos*sizeof(u16) + 2*npos, GFP_KERNEL);
+	if (!p)
+		return ERR_PTR(-ENOMEM);
+	p->npos = npos;
+	p->period = !!(flags & SEARCH_PERIOD);
+	p->icase = icase;
+	p->start = (unsigned long *) (p+1);
+	p->restart = p->start + words;
+	p->accept = p->restart + words;
+	p->slash = p->accept + words;
+	p->set = (unsigned long (*)[SEARCH_SET_LONGS]) (p->slash + words);
+	p->cls = (u16 *) (p->set + nsets);
+	p->op = (unsigned char *) (p->cls + npos);
+	if (suffix) {
+		struct search_suffix *s = (struct search_suffix *) (p->set + nsets);
+
+		s->bits = bits;
+		s->key = (u32 *) (s+1);
+		s->child = (u16 *) (s->key + (1U << bits));
+		p->cls = s->child + (1U << bits);
+		s->final = (unsigned char *) (p->cls + npos);
+		search_suffix_build(s, pattern, icase);
+		p->suffix = s;
+		p->op = s->final + npos;
+	}
+	p->c = p->op + npos;
+
+	anchored = *pattern == '/';
+	__set_bit(0, anchored ? p->start : p->restart);
+	nsets = 0;
+	for (c = pattern, i = 0; i < npos; c++, i++) {
+		switch (*c) {
+			case '\0':
 			case '|':
-				if (pathname[0] == '\0')
-					return SEARCH_MATCH_SUCCESS;
+				p->op[i] = SEARCH_OP_END;
+				__set_bit(i, p->accept);
+				if (*c == '|') {
+					anchored = c[1] == '/';
+					__set_bit(i+1, anchored ? p->start : p->restart);
+				}
+				break;
+			case '*':
+				if ((c == pattern || c[-1] == '/' || c[-1] == '|') && c[1] == '*' && (c[2] == '/' || c[2] == '|' || c[2] == '\0')) {
+					p->op[i] = SEARCH_OP_GLOBSTAR;
+					p->op[i+1] = SEARCH_OP_GLOBSTAR_IN;
+					__set_bit(i+1, p->slash);
+					if (c != pattern && c[-1] == '/' && c[2] != '/')
+						__set_bit(i-1, p->accept); /* a trailing "**" takes the directory before it too */
+					c++, i++;
+					break;
+				}
+				p->op[i] = SEARCH_OP_STAR;
+				break;
+			case '?':
+				p->op[i] = SEARCH_OP_ANY;
+				break;
 			case '/':
-				if (pathname[0] == '\0')
-					return SEARCH_MATCH_PARTIAL;
-				/* else fall-through */
-			default:
-				if (pathname[0] == pattern[0]) {
-					pathname += 1;
-				} else {
-					return SEARCH_MATCH_FAILURE;
+				p->op[i] = SEARCH_OP_SLASH;
+				__set_bit(i, p->slash);
+				break;
+			case '[':
+				len = search_bracket(c, scratch, icase);
+				if (len) {
+					bitmap_copy(p->set[nsets], scratch, 256);
+					p->op[i] = SEARCH_OP_CLASS;
+					p->cls[i] = nsets++;
+					c += len-1;
+					break;
 				}
+				/* not closed, an ordinary character */
+			default:
+				p->op[i] = SEARCH_OP_CHAR;
+				p->c[i] = icase ? search_fold(*c) : *c;
 				break;
 		}
-		pattern += 1;
 	}
+	search_closure(p, p->start);
+	if (!icase)
+		search_literals(p); /* search_filter compares bytes */
+	return p;
 }
 
-/* needs to handle leading '/' for anchor; function should receive base as pathname */
-static enum search_matched match_pathname (const char *pathname, const char *pattern, int flags)
+#define is_filename(c)  ((c) != '/' && (c) != '\0')
+static void search_step (const struct search_pattern *p, const unsigned long *state, unsigned long *next, char c, int leading)
 {
-	enum search_matched status = SEARCH_MATCH_FAILURE;
-	const char *path = pathname;
-	//printk("match_pathname(\"%s\", \"%s\", %d)\n", pathname, pattern, flags);
-	for (; path; path = strchr(path+1, '/')) {
-		const char *patt = pattern;
-		for (; patt; patt = strchrskip(patt+1, '|')) {
-			if (*patt == '/')
-				status = __match_pathname(0, path, patt, flags);
-			else
-				status = __match_pathname(0, path+1, patt, flags);
-			if (status != SEARCH_MATCH_FAILURE)
-				return status;
+	int wild = is_filename(c) && !(leading && c == '.' && p->period);
+	char f = p->icase ? search_fold(c) : c;
+	int i;
+
+	bitmap_zero(next, p->npos);
+	for_each_set_bit(i, state, p->npos) {
+		switch (p->op[i]) {
+			case SEARCH_OP_CHAR:
+				if (p->c[i] != f)
+					break;
+				if (c == '.' && leading && p->period && i > 0 && p->op[i-1] != SEARCH_OP_SLASH && p->op[i-1] != SEARCH_OP_END)
+					break; /* reached past a '*' or '?' that took nothing */
+				__set_bit(i+1, next);
+				break;
+			case SEARCH_OP_ANY:
+				if (wild)
+					__set_bit(i+1, next);
+				break;
+			case SEARCH_OP_CLASS:
+				if (wild && test_bit((unsigned char) c, p->set[p->cls[i]]))
+					__set_bit(i+1, next);
+				break;
+			case SEARCH_OP_GLOBSTAR:
+				if (wild)
+					__set_bit(i+1, next);
+				break;
+			case SEARCH_OP_GLOBSTAR_IN:
+				if (wild)
+					__set_bit(i, next);
+				else if (c == '/')
+					__set_bit(i-1, next); /* on to the next component */
+				break;
+			case SEARCH_OP_STAR:
+				if (wild)
+					__set_bit(i, next);
+				break;
+			case SEARCH_OP_SLASH:
+				if (c == '/')
+					__set_bit(i+1, next);
+				break;
 		}
 	}
-	return status;
+	if (c == '/')
+		bitmap_or(next, next, p->restart, p->npos);
+	search_closure(p, next);
+}
+
+/*
+ * Advance the match state of a directory by one of its entries, that is
+ * by '/' and the name.  The state of the entry is left in state[0..words),
+ * the rest of state is scratch space.
+ */
+static int match_entry (const struct search_pattern *p, const unsigned long *dir, unsigned long *state, const char *name)
+{
+	unsigned long *cur = state;
+	unsigned long *next = state + search_pattern_words(p->npos);
+	const char *c;
+	int how = SEARCH_MATCH_FAILURE;
+
+	//printk("match_entry(\"%s\")\n", name);
+	if (p->suffix) {
+		/* every '/' restarts all of it, the state of the entry does not matter */
+		bitmap_zero(state, p->npos);
+		return search_suffix_match(p, name) ? SEARCH_MATCH_SUCCESS : SEARCH_MATCH_FAILURE;
+	}
+	search_step(p, dir, cur, '/', 0);
+	for (c = name; *c; c++) {
+		if (bitmap_empty(cur, p->npos)) {
+			bitmap_zero(state, p->npos); /* no '/' left to start over */
+			return SEARCH_MATCH_FAILURE;
+		}
+		search_step(p, cur, next, *c, c == name);
+		swap(cur, next);
+	}
+	if (cur != state)
+		bitmap_copy(state, cur, p->npos);
+
+	if (bitmap_intersects(state, p->accept, p->npos))
+		how |= SEARCH_MATCH_SUCCESS;
+	if (bitmap_intersects(state, p->slash, p->npos))
+		how |= SEARCH_MATCH_PARTIAL;
+	return how;
+}
+
+/*
+ * Length of the component starting at position i if it is a plain name,
+ * -1 if it has wildcards.
+ */
+static int search_component (const struct search_pattern *p, int i)
+{
+	int len;
+
+	for (len = 0; p->op[i+len] == SEARCH_OP_CHAR; len++)
+		;
+	if (p->op[i+len] != SEARCH_OP_SLASH && p->op[i+len] != SEARCH_OP_END)
+		return -1;
+	return len;
+}
+
+/*
+ * Can the entries of a directory with this match state be looked up by
+ * name rather than read?  Only if every alternative still alive goes on
+ * with a literal component and none can start over below it.
+ */
+static int search_literal_dir (const struct search_pattern *p, const unsigned long *state)
+{
+	int i;
+
+	if (p->icase)
+		return 0; /* a lookup would not fold */
+	if (!bitmap_empty(p->restart, p->npos))
+		return 0;
+	for_each_set_bit(i, state, p->npos) {
+		int len;
+
+		if (p->op[i] == SEARCH_OP_GLOBSTAR_IN)
+			return 0; /* any name goes */
+		if (p->op[i] != SEARCH_OP_SLASH)
+			continue; /* does not survive the '/' */
+		len = search_component(p, i+1);
+		if (len < 0)
+			return 0;
+		if (p->c[i+1] == '.' && (len == 1 || (len == 2 && p->c[i+2] == '.')))
+			return 0; /* readdir lists these, a lookup would resolve them */
+	}
+	return 1;
 }
 
-#define TREE_DEPTH  16
-#define SEARCH_BUF  (PATH_MAX<<4)
+/* per-directory entry buffer; grown on demand up to the costly order */
+#define SEARCH_BUF_MIN  (NAME_MAX<<1)
+#define SEARCH_BUF_MAX  (PAGE_SIZE<<PAGE_ALLOC_COSTLY_ORDER)
 
-#define SEARCH_STOPATFIRST (1<<0)
-#define SEARCH_METADATA    (1<<1)
-#define SEARCH_INCLUDEROOT (1<<2)
-#define SEARCH_PERIOD      (1<<3)
-#define SEARCH_R_OK        (1<<4)
-#define SEARCH_W_OK        (1<<5)
-#define SEARCH_X_OK        (1<<6)
+/* flags that need the inode of a match, not just its d_type */
+#define SEARCH_ACCESS  (SEARCH_R_OK|SEARCH_W_OK|SEARCH_X_OK)
+#define SEARCH_INODE  (SEARCH_METADATA|SEARCH_ACCESS)
+
+/* results are copied out to the user buffer in batches of up to this */
+#define SEARCH_STAGE_SIZE  (PAGE_SIZE<<2)
+
+/* initial number of directory frames, doubled as the traversal gets deeper */
+#define SEARCH_DEPTH  16
 
 static int isrecursive (const char *pattern)
 {
@@ -1135,26 +1943,43 @@ static int isrecursive (const char *pattern)
 	return 0;
 }
 
+/* one directory entry as packed by search_filldir */
+struct search_entry {
+	loff_t offset; /* f_pos of the entry, for struct search_cursor */
+	unsigned short namelen;
+	unsigned char type;
+	unsigned char skip; /* search_filter: cannot match, not a directory */
+	char name[];
+};
+
+#define search_entry_size(namelen)  ALIGN(offsetof(struct search_entry, name)+(namelen)+1, sizeof(loff_t))
+
 struct search_directory {
-	/* normal stack variables */
 	struct file *fp;
-	char *dir;
-
-	/* large state */
-	char entries[SEARCH_BUF];
+	size_t dir; /* length of ds->path naming this directory */
+	loff_t pos; /* offset of the entry being processed */
+	int literal; /* next pattern position to look up, -1 when read with vfs_readdir */
+	int resume; /* repositioned from a cursor, first entry not processed yet */
+	unsigned long *state; /* match state of the directory */
+
+	/* packed entries from one vfs_readdir batch */
+	char *entries;
+	size_t size;
 	char *next;
-
-	/* matching an entry */
 	char *entry;
-	enum search_matched how;
-	struct kstat stat;
+	int full; /* last batch ran out of room */
+};
+
+/* one of the '|' separated paths, resolved when the search is set up */
+struct search_root {
+	char *name;
 	struct path path;
-	char type;
+	int status; /* lookup error, reported when the root is reached */
 };
 
+struct search_pool;
+
 struct dir_search {
-	/* normal stack variables */
-	int status;
 	int results;
 
 	char *paths;
@@ -1168,38 +1993,158 @@ struct dir_search {
 	int ispattern;
 	size_t base;
 
+	/* compiled pattern, the entry being matched and scratch space for match_entry */
+	struct search_pattern *match;
+	unsigned long *state;
+	unsigned long *cand; /* search_filter scratch, a bit per byte of a batch */
+	struct search_dfa *dfa; /* SEARCH_REGEX, built as it goes */
+
+	struct search_root *roots;
+	int nroots;
+	int root; /* being searched */
+
+	/* SEARCH_CURSOR: position to resume from, saved back when the buffer fills */
+	struct search_cursor cursor;
+
+	/* SEARCH_ARGS, zero without */
+	struct search_args args;
+	unsigned int total; /* results of the whole search, for max_results */
+	u64 deadline; /* jiffies64 this call is to return by, 0 for none */
+	u64 visited; /* entries stepped on by this call */
+	int level; /* depth of the directory at the bottom of the stack */
+	struct search_predicate *preds; /* args.predicates copied in */
+	int npreds;
+	int statpreds; /* some of preds need the inode, not just d_type */
+	struct ts_config *needle; /* args.needle prepared */
+	u64 offset; /* of the needle in the file of the result */
+	struct path fsroot; /* of the caller, workers run with the root of a kworker */
+
+	/* search_open: reads of the session are serialized */
+	struct mutex lock;
+
+	/* set for the workers of a pool, which share everything above */
+	struct search_pool *pool;
+	struct search_worker *worker;
+
+	/* the entry being searched, built up from the canonical root by the frames */
 	char path[PATH_MAX+1];
+	size_t pathlen;
 
 	/* result for copy_search_result with some room for stat */
 	char result[PATH_MAX+1024];
 
+	/* results not copied out to the user buffer yet, see search_copy */
+	char *stage;
+	char __user *staged;
+	size_t stagelen;
+
+	/* mmap()ed session: records go to the ring, written from ringwork */
+	struct search_ring *ring;
+	char *ringdata;
+	u32 ringsize;
+	u32 ringhead; /* ring->head is the user's to scribble on */
+	int stalled; /* ringwork waits for room, under ringlock */
+	int cancel;
+	spinlock_t ringlock;
+	wait_queue_head_t ringwait;
+	struct work_struct ringwork;
+	const struct cred *ringcred;
+
+	/* explicit traversal stack, dirs[depth-1] is the directory being read */
 	struct search_directory *dirs;
+	int depth;
+	int ndirs;
+
+	/* matching an entry */
+	struct kstat stat;
+	struct path lookup;
 
 	/* used for fast PATH search */
 	struct {
 		struct kstat stat;
-		struct path path[2];
+		struct path path;
 	} psearch;
 };
 
-static int search_filldir (void *userdata, const char *name, int namelen, loff_t offset, u64 ino, unsigned int d_type)
-{
-	struct search_directory *ds = (struct search_directory *) userdata;
-
-	if ((int)(SEARCH_BUF-(ds->next-ds->entries)) < namelen+3) {
-		return -EINVAL; /* too many entries */
-	}
+/*
+ * Pool of workers, each with its own stack and path, that walk units: the
+ * roots of a search with several of them, and with SEARCH_PARALLEL also
+ * subdirectories, which a worker that descends while another one is idle
+ * queues instead of walking them itself.  Results are staged in chunks of
+ * one root each, that the caller copies out in the order of the roots.
+ *
+ * Chunks of a root the caller is not copying out yet are held, and held
+ * results have to fit in what is left of the user buffer anyway: a worker
+ * waits before holding more than that.  Units are taken lowest root first,
+ * so that the root being copied out is never stuck behind them.
+ */
+#define SEARCH_WORKERS  64
 
-	/* first char is 'd' for DT_DIR, 'o' for other */
-	if (d_type == DT_DIR) {
-		strcpy(ds->next, "d");
-	} else {
-		strcpy(ds->next, "o");
+struct search_unit {
+	struct list_head list;
+	int root;
+	int level; /* of fp, for struct search_args */
+	struct file *fp;
+	size_t base;
+	size_t pathlen;
+	char *path;
+	unsigned long state[];
+};
+
+struct search_chunk {
+	struct list_head list;
+	int root;
+	size_t len;
+	int results;
+	char data[];
+};
+
+#define SEARCH_CHUNK_SIZE  (SEARCH_BUF_MAX-sizeof(struct search_chunk))
+
+struct search_pool {
+	spinlock_t lock;
+	struct list_head units; /* queued */
+	struct list_head chunks; /* filled, for the caller */
+	int queued; /* units on the list */
+	int pending; /* units queued or being walked */
+	int *remaining; /* per root, units queued or being walked */
+	int idle; /* workers waiting for a unit */
+	int running; /* workers that have not exited */
+	int stop;
+	int status; /* first error of a worker */
+	wait_queue_head_t wait; /* workers, for units */
+	wait_queue_head_t drain; /* the caller, for chunks and finished roots */
+	struct list_head *held; /* per root, chunks the caller cannot copy out yet */
+	size_t bytes; /* in chunks not copied out */
+	size_t room; /* left in the user buffer */
+	int emit; /* root being copied out */
+	const struct cred *cred; /* of the caller */
+	int nworkers;
+	struct search_worker {
+		struct work_struct work;
+		struct search_pool *pool;
+		struct dir_search *ds; /* the worker's own stack and path */
+		struct search_chunk *chunk; /* being filled, for the whole of the walk */
+	} workers[];
+};
+
+static int search_filldir (void *userdata, const char *name, int namelen, loff_t offset, u64 ino, unsigned int d_type)
+{
+	struct search_directory *dir = (struct search_directory *) userdata;
+	struct search_entry *entry = (struct search_entry *) dir->next;
+
+	if (dir->size-(dir->next-dir->entries) < search_entry_size(namelen)) {
+		dir->full = 1;
+		return -EINVAL; /* too many entries */
 	}
-	ds->next += 1;
-	strcpy(ds->next, name);
-	ds->next += namelen+1;
-	*ds->next = '\0';
+
+	entry->offset = offset;
+	entry->namelen = namelen;
+	entry->type = d_type;
+	entry->skip = 0;
+	memcpy(entry->name, name, namelen);
+	entry->name[namelen] = '\0';
+	dir->next += search_entry_size(namelen);
 
 	return 0;
 }
@@ -1241,12 +2186,105 @@ static int search_filldir (void *userdata, const char *name, int namelen, loff_t
 //	return copy_to_user(statbuf,&tmp,sizeof(tmp)) ? -EFAULT : 0;
 //}
 
-static int copy_search_result (struct dir_search *ds, char __user **buf, size_t *len, const char *path, const struct kstat *stat)
+/* Copy the staged results out to the user buffer. */
+static int search_unstage (struct dir_search *ds)
+{
+	size_t len = ds->stagelen;
+
+	ds->stagelen = 0;
+	if (len && copy_to_user(ds->staged, ds->stage, len))
+		return -EFAULT;
+	return 0;
+}
+
+/*
+ * Results go to a kernel chunk for a pool worker.  For the user buffer they
+ * are staged, the stage standing for the user bytes from ds->staged on,
+ * and copied out when a write does not fall within it.
+ */
+static int search_copy (struct dir_search *ds, char __user *to, const void *from, size_t n)
+{
+	if (ds->pool) {
+		memcpy((void __force *) to, from, n);
+		return 0;
+	}
+
+	if (ds->ring) {
+		/* a whole record at the head, published as soon as it is there */
+		memcpy((void __force *) to, from, n);
+		ds->ringhead += n;
+		smp_wmb();
+		ACCESS_ONCE(ds->ring->head) = ds->ringhead;
+		if (waitqueue_active(&ds->ringwait))
+			wake_up_interruptible(&ds->ringwait);
+		return 0;
+	}
+
+	if (ds->stagelen && (to < ds->staged || to > ds->staged+ds->stagelen || to+n > ds->staged+SEARCH_STAGE_SIZE)) {
+		if (search_unstage(ds))
+			return -EFAULT;
+	}
+	if (!ds->stage || n > SEARCH_STAGE_SIZE)
+		return copy_to_user(to, from, n) ? -EFAULT : 0;
+
+	if (!ds->stagelen)
+		ds->staged = to;
+	memcpy(ds->stage+(to-ds->staged), from, n);
+	ds->stagelen = max_t(size_t, ds->stagelen, to+n-ds->staged);
+	return 0;
+}
+
+static int copy_search_record (struct dir_search *ds, char __user **buf, size_t *len, const char *path, unsigned char type, const struct kstat *stat)
+{
+	struct search_record *record = (struct search_record *) ds->result;
+	size_t namelen = strlen(path);
+	size_t reclen = SEARCH_RECLEN(namelen) + (ds->args.needleflags & SEARCH_NEEDLE_OFFSET ? 8 : 0);
+
+	if (reclen > *len)
+		return -ERANGE;
+
+	memset(record, 0, reclen); /* no kernel memory in the padding */
+	record->reclen = reclen;
+	record->namelen = namelen;
+	record->type = type;
+	if (ds->flags & SEARCH_METADATA) {
+		record->type = (stat->mode >> 12) & 15;
+		record->dev = huge_encode_dev(stat->dev);
+		record->ino = stat->ino;
+		record->rdev = huge_encode_dev(stat->rdev);
+		record->size = stat->size;
+		record->blocks = stat->blocks;
+		record->atime = stat->atime.tv_sec;
+		record->mtime = stat->mtime.tv_sec;
+		record->ctime = stat->ctime.tv_sec;
+		record->atime_nsec = stat->atime.tv_nsec;
+		record->mtime_nsec = stat->mtime.tv_nsec;
+		record->ctime_nsec = stat->ctime.tv_nsec;
+		record->mode = stat->mode;
+		record->nlink = stat->nlink;
+		record->uid = stat->uid;
+		record->gid = stat->gid;
+		record->blksize = stat->blksize;
+	}
+	memcpy(record->name, path, namelen);
+	if (ds->args.needleflags & SEARCH_NEEDLE_OFFSET)
+		SEARCH_RECORD_OFFSET(record) = ds->offset;
+
+	if (search_copy(ds, *buf, record, reclen))
+		return -EFAULT;
+	*buf += reclen; *len -= reclen;
+	return 0;
+}
+
+static int copy_search_result (struct dir_search *ds, char __user **buf, size_t *len, const char *path, unsigned char type, const struct kstat *stat)
 {
 	size_t result_len;
 
 	//printk("search: result `%s' ino:%ld mode:%x size:%d\n", path, (long int)stat->ino, (int)stat->mode, (int)stat->size);
 
+	if (ds->flags & SEARCH_BINARY)
+		return copy_search_record(ds, buf, len, path, type, stat);
+
 	if (ds->flags & SEARCH_METADATA)
 		sprintf(ds->result, "0|%s|%zd,%zd,%d,%zd,%d,%d,%zd,%zd,%zd,%zd,%zd,%zd,%zd|", 
 			path,
@@ -1272,7 +2310,7 @@ static int copy_search_result (struct dir_search *ds, char __user **buf, size_t
 
 
 	if (result_len+2 <= *len) { /* double NUL terminator */
-		if (copy_to_user(*buf, ds->result, result_len+2))
+		if (search_copy(ds, *buf, ds->result, result_len+2))
 			return -EFAULT;
         /* NUL does not delimit for parrot implementation, don't include +2 */
 		*buf += result_len; *len -= result_len;
@@ -1292,42 +2330,90 @@ static int abspath (struct path *p, char *path)
 	return 0;
 }
 
-static int search_directory (struct dir_search *ds, int n)
+/* Size the entry buffer of a frame to its directory, reusing what the frame already has. */
+static int search_reserve (struct search_directory *dir, size_t size)
 {
-	//printk("search_directory(%p, %d, %zu, %p:\"%s\", %p:\"%s\", %d, %zu, %p)\n", ds, n, ds->base, ds->path, ds->path, ds->pattern, ds->pattern, ds->flags, ds->len, ds->buf);
+	char *entries;
 
-	if (n >= TREE_DEPTH)
+	size = clamp_t(size_t, size, SEARCH_BUF_MIN, SEARCH_BUF_MAX);
+	if (dir->entries && dir->size >= size)
 		return 0;
 
-	ds->status = 0;
+	entries = kmalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	if (!entries)
+		return dir->entries ? 0 : -ENOMEM; /* a smaller buffer only means more batches */
+	kfree(dir->entries);
+	dir->entries = entries;
+	dir->size = size;
+	return 0;
+}
 
-	ds->dirs[n].fp = filp_open(ds->path, O_DIRECTORY|O_RDONLY|O_LARGEFILE, 0);
-	if (IS_ERR(ds->dirs[n].fp)) {
-		ds->status = PTR_ERR(ds->dirs[n].fp);
-		if (ds->status == -ENOENT || ds->status == -EPERM || ds->status == -EACCES || ds->status == -ENODEV)
-			return 0;
-		goto out;
-	}
+static int search_grow (struct dir_search *ds)
+{
+	struct search_directory *dirs;
+	int ndirs = ds->ndirs ? ds->ndirs<<1 : SEARCH_DEPTH;
+
+	dirs = krealloc(ds->dirs, sizeof(struct search_directory)*ndirs, GFP_KERNEL);
+	if (!dirs)
+		return -ENOMEM;
+	memset(dirs+ds->ndirs, 0, sizeof(struct search_directory)*(ndirs-ds->ndirs));
+	ds->dirs = dirs;
+	ds->ndirs = ndirs;
+	return 0;
+}
 
-	ds->status = abspath(&ds->dirs[n].fp->f_path, ds->path); // expensive??
-	if (ds->status)
-		goto exit;
+/*
+ * May the directory be handed to the filesystem's own search?  It only
+ * knows the text results and flags of the first search(2), whatever else
+ * is asked for takes the walk here.
+ */
+static int search_native (const struct dir_search *ds)
+{
+	if (ds->flags & ~(SEARCH_STOPATFIRST|SEARCH_METADATA|SEARCH_INCLUDEROOT))
+		return 0; /* SEARCH_ICASE, SEARCH_REGEX, SEARCH_PERIOD, SEARCH_*_OK... */
+	if (strchr(ds->pattern, '[') || strstr(ds->pattern, "**"))
+		return 0; /* the globs it takes have neither */
+	if (ds->npreds || ds->args.min_depth || ds->args.max_depth || ds->args.max_results)
+		return 0; /* not applied to what it returns */
+	if (ds->needle)
+		return 0; /* nor is the content looked at */
+	return 1;
+}
+
+/* Push the directory ds->path was opened as, matched to ds->state, on the traversal stack (or hand it to the FS driver). */
+static int search_push (struct dir_search *ds, struct file *fp)
+{
+	struct search_directory *dir;
+	int status;
 
-	if (ds->base == 0) /* not set? */
-		ds->base = strlen(ds->path);
+	if (IS_ERR(fp)) {
+		status = PTR_ERR(fp);
+		if (status == -ENOENT || status == -EPERM || status == -EACCES || status == -ENODEV)
+			return 0;
+		return status;
+	}
 
 	/* Check if FS supports search natively */
-	if (ds->dirs[n].fp->f_op && ds->dirs[n].fp->f_op->search) {
+	if (fp->f_op && fp->f_op->search && search_native(ds)) {
 
 		/* Push search to FS driver */	
 		char *pathbuf = kmalloc(PATH_MAX, GFP_TEMPORARY);
-		struct file *filp = ds->dirs[n].fp;
-		struct inode *inode = filp->f_mapping->host;
-		struct mount *mnt = real_mount(filp->f_path.mnt);
+		struct inode *inode = fp->f_mapping->host;
+		struct mount *mnt = real_mount(fp->f_path.mnt);
 		char *mount_real_path = dentry_path(mnt->mnt_mountpoint, pathbuf, PATH_MAX);
 		char *rel_path = ds->path + strlen(mount_real_path);
 
-		int driver_code = ds->dirs[n].fp->f_op->search(
+		mm_segment_t fs = get_fs();
+		int driver_code;
+
+		if (ds->pool)
+			set_fs(KERNEL_DS); /* a worker's buffer is a kernel chunk */
+		else if (search_unstage(ds)) {
+			kfree(pathbuf);
+			status = -EFAULT;
+			goto out;
+		}
+		driver_code = fp->f_op->search(
 			inode,
 			mount_real_path,
 			rel_path,
@@ -1336,210 +2422,2128 @@ static int search_directory (struct dir_search *ds, int n)
 			ds->next,
 			ds->len
 		);
+		set_fs(fs);
+		kfree(pathbuf);
 
 		ds->results += driver_code;
 		ds->next += driver_code;
 
 		if (driver_code < 0) {
-			ds->status = driver_code;
+			status = driver_code;
 			goto out;
 		}
 
 		ds->len -= driver_code;
+		status = 0;
+		goto out;
+	}
 
-	} else {
-		do {
-			ds->dirs[n].next = ds->dirs[n].entries;
-			ds->status = vfs_readdir(ds->dirs[n].fp, search_filldir, &ds->dirs[n]);
-			if (ds->status)
-				goto exit;
-
-			if (ds->dirs[n].next > ds->dirs[n].entries) {
-				ds->dirs[n].dir = ds->path+strlen(ds->path);
-				for (ds->dirs[n].entry = ds->dirs[n].entries; *ds->dirs[n].entry; ds->dirs[n].entry = ds->dirs[n].entry+strlen(ds->dirs[n].entry)+1) {
-					ds->dirs[n].type = *ds->dirs[n].entry;
-					ds->dirs[n].entry += 1;
-
-					strcat(ds->path, "/");
-					strcat(ds->path, ds->dirs[n].entry);
-					//printk("path: `%s' type: %c\n", ds->path, ds->dirs[n].type);
-
-					ds->dirs[n].how = match_pathname(ds->path+ds->base, ds->pattern, ds->flags);
-					if (ds->dirs[n].how == SEARCH_MATCH_SUCCESS) {
-						//printk("matched `%s'\n", ds->path);
-						ds->status = vfs_path_lookup(ds->dirs[n].fp->f_path.dentry, ds->dirs[n].fp->f_path.mnt, ds->dirs[n].entry, 0, &ds->dirs[n].path);
-						if (ds->status)
-							goto exit;
-			    if (ds->flags & SEARCH_METADATA)
-							ds->status = vfs_getattr(ds->dirs[n].path.mnt, ds->dirs[n].path.dentry, &ds->dirs[n].stat);
-						else
-							memset(&ds->dirs[0].stat, 0, sizeof(struct kstat));
-						path_put(&ds->dirs[n].path);
-						if (ds->status)
-							goto exit;
-						if (ds->flags & SEARCH_INCLUDEROOT)
-							ds->status = copy_search_result(ds, &ds->next, &ds->len, ds->path, &ds->dirs[n].stat);
-						else
-							ds->status = copy_search_result(ds, &ds->next, &ds->len, ds->dirs[n].entry, &ds->dirs[n].stat);
-						if (ds->status)
-							goto exit;
-						ds->results += 1;
-						if (ds->flags & SEARCH_STOPATFIRST)
-							goto exit;
-					}
-					if (ds->dirs[n].type == 'd' && strcmp(ds->dirs[n].entry, ".") != 0 && strcmp(ds->dirs[n].entry, "..") != 0 && (ds->dirs[n].how == SEARCH_MATCH_PARTIAL || ds->isrecursive)) {
-						ds->status = search_directory(ds, n+1);
-						if (ds->status)
-							goto exit;
-						/* check if we found something and STOPATFIRST is set */
-						if (ds->results > 0 && ds->flags & SEARCH_STOPATFIRST)
-							goto exit;
-					} /* else SEARCH_MATCH_FAILURE */
-
-					*ds->dirs[n].dir = '\0';
-				}
+	if (ds->depth == ds->ndirs) {
+		status = search_grow(ds);
+		if (status)
+			goto out;
+	}
+
+	dir = &ds->dirs[ds->depth];
+	if (!dir->state) {
+		dir->state = kmalloc(search_pattern_words(ds->match->npos)*sizeof(long), GFP_KERNEL);
+		if (!dir->state) {
+			status = -ENOMEM;
+			goto out;
+		}
+	}
+	/* the state of the entry that was matched, or the start state for a root */
+	bitmap_copy(dir->state, ds->state, ds->match->npos);
+
+	dir->literal = search_literal_dir(ds->match, dir->state) ? 0 : -1;
+	if (dir->literal < 0)
+		status = search_reserve(dir, i_size_read(fp->f_path.dentry->d_inode));
+	else
+		status = search_reserve(dir, SEARCH_BUF_MIN);
+	if (status)
+		goto out;
+
+	dir->fp = fp;
+	dir->dir = ds->pathlen;
+	dir->entry = dir->next = dir->entries;
+	dir->full = 1; /* nothing read yet */
+	dir->resume = 0;
+
+	if (ds->depth < ds->cursor.depth) {
+		/* restoring a cursor: reread from the entry that was in progress */
+		if (dir->literal < 0) {
+			loff_t pos = vfs_llseek(fp, ds->cursor.pos[ds->depth], SEEK_SET);
+			if (pos < 0) {
+				status = pos;
+				goto out;
 			}
-		} while (ds->dirs[n].next > ds->dirs[n].entries);
+		} else {
+			dir->literal = ds->cursor.pos[ds->depth];
+		}
+		dir->resume = 1;
 	}
 
-exit:
-	goto exitn;
-exitn:
-	filp_close(ds->dirs[n].fp, current->files); /* no need to check error? */
-	goto out;
+	ds->depth += 1;
+	return 0;
 
 out:
-	return ds->status;
+	filp_close(fp, current->files); /* no need to check error? */
+	return status;
 }
 
-SYSCALL_DEFINE5(search, const char __user *, paths, const char __user *, pattern, int, flags, char __user *, buf, size_t, len)
+/* The time budget of this call ran out. */
+static inline int search_expired (struct dir_search *ds)
 {
-	//printk("paths: %s, pattern: %s, flags: %d\n", paths, pattern, flags);
+	return ds->deadline && time_after_eq64(get_jiffies_64(), ds->deadline);
+}
 
-	int status = 0;
-	struct dir_search *ds;
+static inline void search_set_deadline (struct dir_search *ds)
+{
+	ds->deadline = ds->args.timeout_ns ? get_jiffies_64() + nsecs_to_jiffies64(ds->args.timeout_ns) : 0;
+}
 
-	char *c;
-	char *n;
+/* max_results of SEARCH_ARGS reached */
+static inline int search_full (struct dir_search *ds)
+{
+	return ds->args.max_results && ds->total >= ds->args.max_results;
+}
 
-	if (!access_ok(VERIFY_WRITE, buf, len)) {
-		status = -EFAULT;
-		goto exit0;
-	}
+/* Cut ds->path back to the directory at the top of the stack. */
+static void search_path_pop (struct dir_search *ds)
+{
+	ds->pathlen = ds->dirs[ds->depth-1].dir;
+	ds->path[ds->pathlen] = '\0';
+}
 
-	ds = kmalloc(sizeof(struct dir_search), GFP_KERNEL);
-	if (!ds) {
-		status = -ENOMEM;
-		goto exit0;
-	}
+static void search_pop (struct dir_search *ds)
+{
+	ds->depth -= 1;
+	filp_close(ds->dirs[ds->depth].fp, current->files); /* no need to check error? */
+	if (ds->depth > 0)
+		search_path_pop(ds);
+}
 
-	ds->results = 0;
+/*
+ * Resolve an entry of an open directory: one dcache lookup relative to the
+ * directory, ->lookup under i_mutex only on a miss.  Like vfs_path_lookup
+ * with no flags, mounts on the entry are crossed and symlinks are not.
+ */
+static int search_lookup (struct search_directory *dir, const char *name, int namelen, struct path *path)
+{
+	struct dentry *parent = dir->fp->f_path.dentry;
+	struct dentry *dentry;
+	struct qstr this;
+	int status;
 
-	ds->paths = getname(paths);
-	if (IS_ERR(ds->paths)) {
-		status = PTR_ERR(ds->paths);
-		goto exit1;
+	if (name[0] == '.' && (namelen == 1 || (namelen == 2 && name[1] == '.')))
+		return vfs_path_lookup(parent, dir->fp->f_path.mnt, name, 0, path);
+
+	status = inode_permission(parent->d_inode, MAY_EXEC);
+	if (status)
+		return status;
+	this.name = (const unsigned char *)name;
+	this.len = namelen;
+	dentry = d_hash_and_lookup(parent, &this);
+	if (dentry && dentry->d_flags & DCACHE_OP_REVALIDATE && dentry->d_op->d_revalidate(dentry, NULL) <= 0) {
+		dput(dentry);
+		dentry = NULL;
 	}
-
-	ds->pattern = getname(pattern);
-	if (IS_ERR(ds->pattern)) {
-		status = PTR_ERR(ds->pattern);
-		goto exit2;
+	if (!dentry) {
+		mutex_lock(&parent->d_inode->i_mutex);
+		dentry = lookup_one_len(name, parent, namelen);
+		mutex_unlock(&parent->d_inode->i_mutex);
+		if (IS_ERR(dentry))
+			return PTR_ERR(dentry);
+	}
+	if (!dentry->d_inode) {
+		dput(dentry);
+		return -ENOENT;
 	}
+	path->dentry = dentry;
+	path->mnt = mntget(dir->fp->f_path.mnt);
+	while (d_mountpoint(path->dentry) && follow_down_one(path))
+		;
+	return 0;
+}
 
-	ds->flags = flags;
-	ds->buf = ds->next = buf;
-	ds->len = len;
-	ds->dirs = NULL;
+/*
+ * Look up the names the pattern goes on with instead of reading the
+ * directory.  Entries are numbered by the position of their '/' in the
+ * pattern, which is what a cursor records for them.
+ */
+static int search_fill_literal (struct dir_search *ds, struct search_directory *dir)
+{
+	const struct search_pattern *p = ds->match;
+	int i;
+
+	for (i = find_next_bit(dir->state, p->npos, dir->literal); i < p->npos; i = find_next_bit(dir->state, p->npos, i+1)) {
+		struct search_entry *entry = (struct search_entry *) dir->next;
+		int len;
+		int j;
+		int status;
+
+		if (p->op[i] != SEARCH_OP_SLASH)
+			continue;
+		len = search_component(p, i+1);
+		if (len == 0 || len > NAME_MAX)
+			continue;
+		for (j = find_first_bit(dir->state, p->npos); j < i; j = find_next_bit(dir->state, p->npos, j+1)) {
+			if (p->op[j] == SEARCH_OP_SLASH && search_component(p, j+1) == len && memcmp(p->c+j+1, p->c+i+1, len) == 0)
+				break;
+		}
+		if (j < i)
+			continue; /* already looked up for another alternative */
+
+		if (dir->size-(dir->next-dir->entries) < search_entry_size(len)) {
+			dir->full = 1;
+			break;
+		}
 
-	ds->isrecursive = isrecursive(ds->pattern);
-	ds->ispattern = ispattern(ds->pattern);
+		entry->offset = i;
+		entry->namelen = len;
+		memcpy(entry->name, p->c+i+1, len);
+		entry->name[len] = '\0';
 
-	if (ds->ispattern) {
-		ds->dirs = kmalloc(sizeof(struct search_directory)*TREE_DEPTH, GFP_KERNEL);
-		if (!ds->dirs) {
-			goto exit3;
+		status = search_lookup(dir, entry->name, len, &ds->lookup);
+		if (status == -ENOENT)
+			continue;
+		else if (status)
+			return status;
+		entry->type = (ds->lookup.dentry->d_inode->i_mode >> 12) & 15;
+		path_put(&ds->lookup);
+
+		dir->next += search_entry_size(len);
+	}
+	dir->literal = i;
+	return 0;
+}
+
+/*
+ * Mark in cand the offsets of buf where lit[0] is, followed by lit[1]
+ * unless one.  In a directory of many entries, few of them wanted, this
+ * scan is most of the work, so SSE2 does it 16 bytes at a time.
+ */
+static void search_scan (const char *buf, size_t len, const unsigned char *lit, int one, unsigned long *cand)
+{
+	size_t i = 0;
+
+	bitmap_zero(cand, len);
+#ifdef CONFIG_X86
+	if (len >= 17 && cpu_has_xmm2 && irq_fpu_usable()) {
+		u16 *mask = (u16 *) cand; /* little endian */
+
+		kernel_fpu_begin();
+		asm volatile("movd %0,%%xmm0; pshufd $0,%%xmm0,%%xmm0" : : "r" (lit[0]*0x01010101U));
+		asm volatile("movd %0,%%xmm1; pshufd $0,%%xmm1,%%xmm1" : : "r" (lit[one ? 0 : 1]*0x01010101U));
+		for (; i+17 <= len; i += 16) {
+			unsigned int m;
+
+			asm volatile("movdqu %0,%%xmm2" : : "m" (*(const char (*)[16]) (buf+i)));
+			asm volatile("pcmpeqb %xmm0,%xmm2");
+			if (!one) {
+				asm volatile("movdqu %0,%%xmm3" : : "m" (*(const char (*)[16]) (buf+i+1)));
+				asm volatile("pcmpeqb %xmm1,%xmm3");
+				asm volatile("pand %xmm3,%xmm2");
+			}
+			asm volatile("pmovmskb %%xmm2,%0" : "=r" (m));
+			mask[i/16] = m;
 		}
-	} else {
-		while (*ds->pattern == '/')
-		  ds->pattern += 1; /* remove leading forward slashes */
+		kernel_fpu_end();
 	}
+#endif
+	for (; i < len; i++) {
+		if (buf[i] == lit[0] && (one || (i+1 < len && buf[i+1] == lit[1])))
+			__set_bit(i, cand);
+	}
+}
 
-	//printk("search(%p:\"%s\", %p:\"%s\", %d, %zu, %p)\n", paths, ds->paths, pattern, ds->pattern, ds->flags, ds->len, ds->buf);
+/*
+ * Before matching a batch one entry at a time, rule out in bulk the ones
+ * that contain no literal the pattern needs, unless they are directories
+ * to descend into.
+ */
+static void search_filter (struct dir_search *ds, struct search_directory *dir)
+{
+	const struct search_pattern *p = ds->match;
+	size_t len = dir->next - dir->entries;
+	struct search_entry *entry;
+	char *e;
+	int k;
+
+	if (!ds->cand) {
+		ds->cand = kmalloc(BITS_TO_LONGS(SEARCH_BUF_MAX)*sizeof(long), GFP_KERNEL | __GFP_NOWARN);
+		if (!ds->cand)
+			return; /* all of them are matched then */
+	}
 
-	n = ds->paths;
-	while ((c = strsep(&n, "|")) != NULL) {
-		strcpy(ds->path, c);
+	for (e = dir->entries; e < dir->next; e += search_entry_size(entry->namelen)) {
+		entry = (struct search_entry *) e;
+		entry->skip = entry->type != DT_DIR && entry->type != DT_UNKNOWN;
+	}
+	for (k = 0; k < p->nlits; k++) {
+		const unsigned char *lit = p->c + p->lit[k].pos;
+		int litlen = p->lit[k].len;
 
-		if (ds->ispattern) {
-			ds->base = 0; /* reset base to 0 as we are searching a new top-level directory */
-			status = search_directory(ds, 0);
-			if (status)
-				goto exit;
-			if (ds->results > 0 && ds->flags & SEARCH_STOPATFIRST)
-				break;
-		} else {
-			/* TODO Really this should be merged into search_directory where each path component in the pattern is examined.
-			   If there is no special characters in the pattern, then try to open the component directly and decompose the pattern.
-			   Unfortunately this requires also putting pattern examination in search_directory when it's separate in match_pathname.
-			   This will do for now...
-			 */
-			/* here we do another path_lookup and follow symlinks, we didn't the first time because we need the path with the final symlink */
-			status = kern_path(ds->path, LOOKUP_FOLLOW, &ds->psearch.path[0]);
-			if (status == -ENOENT)
-				continue;
-			else if (status)
-				goto exit;
-			ds->base = strlen(ds->path);
-			strcat(ds->path, "/");
-			strcat(ds->path, ds->pattern);
-			status = vfs_path_lookup(ds->psearch.path[0].dentry, ds->psearch.path[0].mnt, ds->pattern, 0, &ds->psearch.path[1]);
-			path_put(&ds->psearch.path[0]);
-			if (status == -ENOENT)
+		search_scan(dir->entries, len, lit, litlen == 1, ds->cand);
+		for (e = dir->entries; e < dir->next; e += search_entry_size(entry->namelen)) {
+			size_t start, end, i;
+
+			entry = (struct search_entry *) e;
+			if (!entry->skip || entry->namelen < litlen)
 				continue;
-			else if (status)
-				goto exit;
-			if (ds->flags & SEARCH_METADATA)
-				status = vfs_getattr(ds->psearch.path[1].mnt, ds->psearch.path[1].dentry, &ds->psearch.stat);
-			else
-				memset(&ds->psearch.stat, 0, sizeof(struct kstat));
-			path_put(&ds->psearch.path[1]);
-			if (status)
-				goto exit;
-			if (ds->flags & SEARCH_INCLUDEROOT)
-				status = copy_search_result(ds, &ds->next, &ds->len, ds->path, &ds->psearch.stat);
-			else
-				status = copy_search_result(ds, &ds->next, &ds->len, ds->path+ds->base, &ds->psearch.stat);
-			if (status)
-				goto exit;
-			ds->results += 1;
-			if (ds->flags & SEARCH_STOPATFIRST)
-				break;
+			start = entry->name - dir->entries;
+			end = start + entry->namelen - litlen + 1;
+			for (i = find_next_bit(ds->cand, end, start); i < end; i = find_next_bit(ds->cand, end, i+1)) {
+				if (memcmp(dir->entries+i, lit, litlen) == 0) {
+					entry->skip = 0;
+					break;
+				}
+			}
 		}
 	}
-	if (ds->buf != ds->next) {
-		/* this is a sad hack because the '|' delimiter design
-		 * makes programming this rather difficult.
-		 * We remove the final '|' that was added.
-		 */
-		status = copy_to_user(ds->next-1, "\0\0", 2);
-		if (status)
-			goto exit;
+}
+
+/* Read the next batch of entries; a batch that did not fill the buffer was the last one. */
+static int search_fill (struct dir_search *ds, struct search_directory *dir)
+{
+	int status;
+
+	if (!dir->full)
+		return 0;
+	if (dir->literal >= 0) {
+		dir->full = 0;
+		dir->entry = dir->next = dir->entries;
+		return search_fill_literal(ds, dir);
 	}
-	status = ds->results;
+	if (dir->next > dir->entries)
+		search_reserve(dir, dir->size<<1);
+	dir->full = 0;
+	dir->entry = dir->next = dir->entries;
+	status = vfs_readdir(dir->fp, search_filldir, dir);
+	if (status == 0 && ds->match->nlits && dir->next > dir->entries)
+		search_filter(ds, dir);
+	return status;
+}
 
-	//printk("buffer: %s\n", buf);
+/* Append the entry to ds->path, which names its directory. */
+static int search_name (struct dir_search *ds, struct search_directory *dir, const struct search_entry *entry)
+{
+	if (dir->dir+1+entry->namelen > PATH_MAX)
+		return -ENAMETOOLONG;
+	ds->path[dir->dir] = '/';
+	memcpy(ds->path+dir->dir+1, entry->name, entry->namelen+1);
+	ds->pathlen = dir->dir+1+entry->namelen;
+	return 0;
+}
 
-exit:
-	goto exitn;
-exitn:
-	kfree(ds->dirs);
-exit3:
-	putname(ds->pattern);
-exit2:
-	putname(ds->paths);
-exit1:
-	kfree(ds);
-exit0:
-    return status;
+/* Queue the directory ds->path was opened as, matched to ds->state, for the workers. */
+static int search_queue (struct search_pool *pool, struct dir_search *ds, struct file *fp)
+{
+	size_t words = search_pattern_words(ds->match->npos);
+	struct search_unit *unit, *pos;
+
+	unit = kmalloc(sizeof(struct search_unit)+words*sizeof(long)+ds->pathlen+1, GFP_KERNEL);
+	if (!unit)
+		return -ENOMEM;
+	unit->root = ds->root;
+	unit->level = ds->level + ds->depth;
+	unit->fp = fp;
+	unit->base = ds->base;
+	unit->pathlen = ds->pathlen;
+	unit->path = (char *) (unit->state+words);
+	memcpy(unit->path, ds->path, ds->pathlen+1);
+	bitmap_copy(unit->state, ds->state, ds->match->npos);
+
+	spin_lock(&pool->lock);
+	list_for_each_entry_reverse(pos, &pool->units, list) {
+		if (pos->root <= unit->root)
+			break;
+	}
+	list_add(&unit->list, &pos->list);
+	pool->queued += 1;
+	pool->pending += 1;
+	pool->remaining[unit->root] += 1;
+	spin_unlock(&pool->lock);
+	wake_up(&pool->wait);
+	return 0;
+}
+
+/* Open the entry just named by search_name, relative to its directory, and push it (or give it to an idle worker). */
+static int search_descend (struct dir_search *ds)
+{
+	int depth = ds->depth;
+	struct search_directory *dir = &ds->dirs[depth-1];
+	struct file *fp;
+	int status;
+
+	fp = file_open_root(dir->fp->f_path.dentry, dir->fp->f_path.mnt, ds->path+dir->dir+1, O_DIRECTORY|O_RDONLY|O_LARGEFILE|O_NOFOLLOW);
+	if (ds->pool && ds->flags & SEARCH_PARALLEL && !IS_ERR(fp) && ACCESS_ONCE(ds->pool->idle) > ACCESS_ONCE(ds->pool->queued) && search_queue(ds->pool, ds, fp) == 0)
+		status = 0; /* not pushed */
+	else
+		status = search_push(ds, fp);
+	if (status == 0 && ds->depth == depth) /* not pushed, ds->path back to the directory */
+		search_path_pop(ds);
+	return status;
+}
+
+static int search_flush (struct search_worker *w);
+
+/*
+ * SEARCH_R_OK, SEARCH_W_OK, SEARCH_X_OK: may the caller use what path,
+ * looked up as name from base, names?  As with faccessat(AT_EACCESS), a
+ * symlink is judged by its target.  1 if so, 0 if not, or an error.
+ *
+ * The link is followed from the caller's root, by the name base has below
+ * it: vfs_path_lookup from base would take an absolute target to be below
+ * base, and a worker's own root and mounts are not the caller's.
+ */
+static int search_access (struct dir_search *ds, const struct path *path, const struct path *base, const char *name)
+{
+	struct inode *inode = path->dentry->d_inode;
+	struct path target;
+	char *buf, *dir;
+	size_t len;
+	int mask = 0;
+	int status;
+
+	if (ds->flags & SEARCH_R_OK)
+		mask |= MAY_READ;
+	if (ds->flags & SEARCH_W_OK)
+		mask |= MAY_WRITE;
+	if (ds->flags & SEARCH_X_OK)
+		mask |= MAY_EXEC;
+	if (!mask)
+		return 1;
+
+	if (!S_ISLNK(inode->i_mode))
+		return inode_permission(inode, mask) == 0;
+
+	buf = __getname();
+	if (!buf)
+		return -ENOMEM;
+	dir = __d_path(base, &ds->fsroot, buf, PATH_MAX);
+	status = 0;
+	if (!dir)
+		goto out; /* out of the caller's reach */
+	status = PTR_ERR(dir);
+	if (IS_ERR(dir))
+		goto out;
+	len = strlen(dir);
+	status = -ENAMETOOLONG;
+	if (len+1+strlen(name)+1 > PATH_MAX)
+		goto out;
+	memmove(buf, dir, len); /* __d_path builds it at the end of buf */
+	buf[len] = '/';
+	strcpy(buf+len+1, name);
+
+	status = vfs_path_lookup(ds->fsroot.dentry, ds->fsroot.mnt, buf, LOOKUP_FOLLOW, &target);
+	if (status == -ENOENT || status == -ELOOP || status == -EACCES || status == -ENOTDIR) {
+		status = 0; /* dangling, or cannot be followed */
+		goto out;
+	}
+	if (status)
+		goto out;
+	status = inode_permission(target.dentry->d_inode, mask) == 0;
+	path_put(&target);
+out:
+	__putname(buf);
+	return status;
+}
+
+#ifdef CONFIG_TEXTSEARCH
+/* A file being searched for the needle, one page of it mapped at a time. */
+struct search_text {
+	struct file *fp;
+	loff_t size;
+	struct page *page;
+	int error;
+};
+
+static void search_text_finish (struct ts_config *conf, struct ts_state *state)
+{
+	struct search_text *text = *(struct search_text **) state->cb;
+
+	if (text->page) {
+		kunmap(text->page);
+		page_cache_release(text->page);
+		text->page = NULL;
+	}
+}
+
+static unsigned int search_text_next (unsigned int consumed, const u8 **dst, struct ts_config *conf, struct ts_state *state)
+{
+	struct search_text *text = *(struct search_text **) state->cb;
+	struct page *page;
+
+	search_text_finish(conf, state);
+	if (consumed >= text->size)
+		return 0;
+	if (fatal_signal_pending(current)) {
+		text->error = -EINTR;
+		return 0;
+	}
+	cond_resched();
+
+	page = read_mapping_page(text->fp->f_mapping, consumed >> PAGE_CACHE_SHIFT, text->fp);
+	if (IS_ERR(page)) {
+		text->error = PTR_ERR(page);
+		return 0;
+	}
+	text->page = page;
+	*dst = kmap(page);
+	return min_t(loff_t, PAGE_CACHE_SIZE, text->size-consumed);
+}
+
+/* Copy in and prepare the needle of ds->args. */
+static int search_copy_needle (struct dir_search *ds)
+{
+	int flags = TS_AUTOLOAD;
+	void *needle;
+
+	if (!ds->args.needlelen)
+		return ds->args.needleflags ? -EINVAL : 0;
+	if (ds->args.needlelen > SEARCH_NEEDLE_MAX)
+		return -E2BIG;
+	if (ds->args.needleflags & ~(SEARCH_NEEDLE_ICASE|SEARCH_NEEDLE_OFFSET))
+		return -EINVAL;
+	if (ds->args.needleflags & SEARCH_NEEDLE_OFFSET && !(ds->flags & SEARCH_BINARY))
+		return -EINVAL; /* no room for it in the text format */
+	if (ds->args.needleflags & SEARCH_NEEDLE_ICASE)
+		flags |= TS_IGNORECASE;
+
+	needle = memdup_user((const void __user *) (unsigned long) ds->args.needle, ds->args.needlelen);
+	if (IS_ERR(needle))
+		return PTR_ERR(needle);
+	/* kmp, unlike bm, finds what straddles two pages */
+	ds->needle = textsearch_prepare("kmp", needle, ds->args.needlelen, GFP_KERNEL, flags);
+	kfree(needle);
+	if (IS_ERR(ds->needle)) {
+		int status = PTR_ERR(ds->needle);
+		ds->needle = NULL;
+		return status;
+	}
+	ds->needle->get_next_block = search_text_next;
+	ds->needle->finish = search_text_finish;
+	return 0;
+}
+
+/* Is the needle in the regular file name of base?  1 if so, setting ds->offset, 0 if not, or an error. */
+static int search_content (struct dir_search *ds, const struct path *base, const char *name)
+{
+	struct search_text text = { .page = NULL, .error = 0 };
+	struct search_text *ptext = &text;
+	struct ts_state state;
+	unsigned int pos;
+	int status;
+
+	text.fp = file_open_root(base->dentry, base->mnt, name, O_RDONLY|O_LARGEFILE|O_NOFOLLOW|O_NONBLOCK);
+	if (IS_ERR(text.fp)) {
+		status = PTR_ERR(text.fp);
+		if (status == -ENOENT || status == -EACCES || status == -ELOOP || status == -EPERM)
+			return 0; /* gone, or not for the caller to read */
+		if (status == -EAGAIN || status == -ENXIO || status == -ETXTBSY)
+			return 0; /* leased (-EWOULDBLOCK), or not to be opened now */
+		return status;
+	}
+	if (!S_ISREG(text.fp->f_mapping->host->i_mode) || !text.fp->f_mapping->a_ops->readpage) {
+		fput(text.fp);
+		return 0;
+	}
+	text.size = min_t(loff_t, i_size_read(text.fp->f_mapping->host), UINT_MAX & PAGE_CACHE_MASK);
+
+	memcpy(state.cb, &ptext, sizeof(ptext));
+	pos = textsearch_find(ds->needle, &state);
+	fput(text.fp);
+	if (text.error)
+		return text.error;
+	if (pos == UINT_MAX)
+		return 0;
+	ds->offset = pos;
+	return 1;
+}
+#else
+static int search_copy_needle (struct dir_search *ds)
+{
+	return ds->args.needlelen ? -EOPNOTSUPP : 0;
+}
+
+static int search_content (struct dir_search *ds, const struct path *base, const char *name)
+{
+	return 0;
+}
+#endif
+
+/*
+ * The DFA for SEARCH_REGEX is built as names need it, one per walker
+ * since the workers of a pool share the NFA.  A DFA state is a set of
+ * NFA states, after the bytes so far and a new start at each byte, the
+ * search being unanchored.  Past SEARCH_DFA_MEM no more states are made
+ * and the NFA is run on sets directly: linear in the name either way.
+ */
+#define SEARCH_DFA_MEM   (PAGE_SIZE<<6)
+#define SEARCH_DFA_HASH  64
+
+struct search_dstate {
+	struct hlist_node hash;
+	u32 key;
+	int match; /* the NFA got to SEARCH_NOP_MATCH, whatever follows */
+	int final; /* it does if the name ends here */
+	struct search_dstate *next[256]; /* NULL until needed */
+	int n;
+	int nfa[]; /* sorted */
+};
+
+struct search_dfa {
+	size_t mem;
+	struct search_dstate *start;
+	struct hlist_head hash[SEARCH_DFA_HASH];
+	/* scratch space, a slot per NFA state and twice that for stack */
+	int *list;
+	int *list2;
+	int *tmp;
+	int *stack;
+	unsigned int *mark;
+	unsigned int gen; /* states with mark[] == gen are on the list being built */
+};
+
+static struct search_dfa *search_dfa_alloc (const struct search_regex *r)
+{
+	struct search_dfa *d;
+	int n = r->nstates;
+
+	d = kzalloc(sizeof(struct search_dfa) + (6*n+1)*sizeof(int), GFP_KERNEL);
+	if (!d)
+		return NULL;
+	d->list = (int *) (d+1);
+	d->list2 = d->list + n;
+	d->tmp = d->list2 + n;
+	d->mark = (unsigned int *) (d->tmp + n);
+	d->stack = (int *) (d->mark + n);
+	return d;
+}
+
+static void search_dfa_free (struct search_dfa *d)
+{
+	struct search_dstate *state;
+	struct hlist_node *pos, *n;
+	int i;
+
+	if (!d)
+		return;
+	for (i = 0; i < SEARCH_DFA_HASH; i++) {
+		hlist_for_each_entry_safe(state, pos, n, &d->hash[i], hash)
+			kfree(state);
+	}
+	kfree(d);
+}
+
+/* Add s to list, following what needs no byte; a '^' only at the start of the name. */
+static void search_rclosure (const struct search_regex *r, struct search_dfa *d, int *list, int *n, int s, int bol)
+{
+	int top = 0;
+
+	d->stack[top++] = s;
+	while (top > 0) {
+		const struct search_nstate *st;
+
+		s = d->stack[--top];
+		if (d->mark[s] == d->gen)
+			continue;
+		d->mark[s] = d->gen;
+		st = &r->st[s];
+		switch (st->op) {
+			case SEARCH_NOP_SPLIT:
+				d->stack[top++] = st->out1;
+				d->stack[top++] = st->out;
+				break;
+			case SEARCH_NOP_JUMP:
+				d->stack[top++] = st->out;
+				break;
+			case SEARCH_NOP_BOL:
+				if (bol)
+					d->stack[top++] = st->out;
+				break;
+			default:
+				list[(*n)++] = s;
+				break;
+		}
+	}
+}
+
+/* Does the NFA get to a match from list if the name ends there? */
+static int search_rfinal (const struct search_regex *r, struct search_dfa *d, const int *list, int n)
+{
+	int m = 0;
+	int i;
+
+	d->gen++;
+	for (i = 0; i < n; i++)
+		search_rclosure(r, d, d->tmp, &m, list[i], 0);
+	for (i = 0; i < m; i++) {
+		const struct search_nstate *st = &r->st[d->tmp[i]];
+
+		if (st->op == SEARCH_NOP_MATCH)
+			return 1;
+		if (st->op == SEARCH_NOP_EOL)
+			search_rclosure(r, d, d->tmp, &m, st->out, 0);
+	}
+	return 0;
+}
+
+/* The NFA states, in next, after byte c from those in list. */
+static int search_rstep (const struct search_regex *r, struct search_dfa *d, const int *list, int n, unsigned char c, int *next)
+{
+	int m = 0;
+	int i;
+
+	d->gen++;
+	for (i = 0; i < n; i++) {
+		const struct search_nstate *st = &r->st[list[i]];
+
+		if ((st->op == SEARCH_NOP_CHAR && st->c == c) || st->op == SEARCH_NOP_ANY || (st->op == SEARCH_NOP_SET && test_bit(c, r->set[st->set])))
+			search_rclosure(r, d, next, &m, st->out, 0);
+	}
+	search_rclosure(r, d, next, &m, r->start, 0); /* a match may start at the next byte */
+	return m;
+}
+
+static int search_rcmp (const void *a, const void *b)
+{
+	return *(const int *) a - *(const int *) b;
+}
+
+/* The DFA state for the NFA states in list, made if need be; NULL when the DFA is full. */
+static struct search_dstate *search_dstate (const struct search_regex *r, struct search_dfa *d, int *list, int n)
+{
+	struct search_dstate *state;
+	struct hlist_node *pos;
+	size_t size = sizeof(struct search_dstate) + n*sizeof(int);
+	u32 key;
+	int i;
+
+	sort(list, n, sizeof(int), search_rcmp, NULL);
+	key = jhash2((u32 *) list, n, n);
+	hlist_for_each_entry(state, pos, &d->hash[key % SEARCH_DFA_HASH], hash) {
+		if (state->key == key && state->n == n && memcmp(state->nfa, list, n*sizeof(int)) == 0)
+			return state;
+	}
+
+	if (d->mem + size > SEARCH_DFA_MEM)
+		return NULL;
+	state = kzalloc(size, GFP_KERNEL | __GFP_NOWARN);
+	if (!state)
+		return NULL;
+	d->mem += size;
+	state->key = key;
+	state->n = n;
+	memcpy(state->nfa, list, n*sizeof(int));
+	for (i = 0; i < n; i++) {
+		if (r->st[list[i]].op == SEARCH_NOP_MATCH)
+			state->match = 1;
+	}
+	state->final = state->match || search_rfinal(r, d, list, n);
+	hlist_add_head(&state->hash, &d->hash[key % SEARCH_DFA_HASH]);
+	return state;
+}
+
+/* Without the DFA: on from the n NFA states in list, which is d->list or d->list2. */
+static int search_nfa_run (const struct search_regex *r, struct search_dfa *d, int *list, int n, const char *c)
+{
+	int *next = list == d->list ? d->list2 : d->list;
+	int i;
+
+	for (;; c++) {
+		for (i = 0; i < n; i++) {
+			if (r->st[list[i]].op == SEARCH_NOP_MATCH)
+				return 1;
+		}
+		if (!*c)
+			return search_rfinal(r, d, list, n);
+		if (!n)
+			return 0;
+		n = search_rstep(r, d, list, n, r->icase ? search_fold(*c) : *c, next);
+		swap(list, next);
+	}
+}
+
+/* Is the regex of SEARCH_REGEX found in name?  Or an error. */
+static int search_regex_match (struct dir_search *ds, const char *name)
+{
+	const struct search_regex *r = ds->match->regex;
+	struct search_dfa *d = ds->dfa;
+	struct search_dstate *state;
+	const char *c;
+	int n;
+
+	if (!d) {
+		d = ds->dfa = search_dfa_alloc(r);
+		if (!d)
+			return -ENOMEM;
+	}
+	if (!d->start) {
+		n = 0;
+		d->gen++;
+		search_rclosure(r, d, d->list, &n, r->start, 1);
+		d->start = search_dstate(r, d, d->list, n);
+		if (!d->start)
+			return search_nfa_run(r, d, d->list, n, name);
+	}
+
+	for (state = d->start, c = name; *c; c++) {
+		unsigned char b = r->icase ? search_fold(*c) : *c;
+		struct search_dstate *next;
+
+		if (state->match)
+			return 1;
+		if (!state->n)
+			return 0; /* a '^' that did not match */
+		next = state->next[b];
+		if (!next) {
+			n = search_rstep(r, d, state->nfa, state->n, b, d->list);
+			next = search_dstate(r, d, d->list, n);
+			if (!next)
+				return search_nfa_run(r, d, d->list, n, c+1); /* the DFA is full */
+			state->next[b] = next;
+		}
+		state = next;
+	}
+	return state->final;
+}
+
+/*
+ * Do the predicates hold for an entry of type?  Without stat only those
+ * on the type are tried, and not even those if readdir did not know it.
+ */
+static int search_test (struct dir_search *ds, unsigned char type, const struct kstat *stat)
+{
+	int i;
+
+	if (stat)
+		type = (stat->mode >> 12) & 15;
+	for (i = 0; i < ds->npreds; i++) {
+		const struct search_predicate *pred = &ds->preds[i];
+		s64 field;
+		s64 value = pred->value;
+
+		if (pred->field != SEARCH_FIELD_TYPE && !stat)
+			continue;
+		switch (pred->field) {
+		case SEARCH_FIELD_TYPE:
+			if (type == DT_UNKNOWN)
+				continue;
+			field = type;
+			break;
+		case SEARCH_FIELD_SIZE:
+			field = stat->size;
+			break;
+		case SEARCH_FIELD_MTIME:
+			field = stat->mtime.tv_sec;
+			break;
+		case SEARCH_FIELD_UID:
+			field = stat->uid;
+			break;
+		case SEARCH_FIELD_GID:
+			field = stat->gid;
+			break;
+		default: /* SEARCH_FIELD_PERM */
+			field = stat->mode & 07777;
+			break;
+		}
+		switch (pred->op) {
+		case SEARCH_CMP_EQ:
+			if (field != value)
+				return 0;
+			break;
+		case SEARCH_CMP_NE:
+			if (field == value)
+				return 0;
+			break;
+		case SEARCH_CMP_LT:
+			if (field >= value)
+				return 0;
+			break;
+		case SEARCH_CMP_GT:
+			if (field <= value)
+				return 0;
+			break;
+		case SEARCH_CMP_ALL:
+			if ((field & value) != value)
+				return 0;
+			break;
+		default: /* SEARCH_CMP_ANY */
+			if (!(field & value))
+				return 0;
+			break;
+		}
+	}
+	return 1;
+}
+
+static int search_entry (struct dir_search *ds, struct search_directory *dir, const struct search_entry *entry)
+{
+	int depth = ds->level + ds->depth; /* of the entry */
+	int needstat = ds->statpreds || ((ds->npreds || ds->needle) && entry->type == DT_UNKNOWN);
+	int how;
+	int status;
+
+	if (search_name(ds, dir, entry))
+		return 0; /* cannot be named */
+	//printk("path: `%s' type: %d\n", ds->path, entry->type);
+
+	how = match_entry(ds->match, dir->state, ds->state, entry->name);
+	if (how & SEARCH_MATCH_SUCCESS && ds->match->regex) {
+		status = search_regex_match(ds, entry->name);
+		if (status < 0)
+			return status;
+		if (!status)
+			how &= ~SEARCH_MATCH_SUCCESS;
+	}
+	if (how & SEARCH_MATCH_SUCCESS && depth >= ds->args.min_depth) {
+		//printk("matched `%s'\n", ds->path);
+		memset(&ds->stat, 0, sizeof(struct kstat));
+		if (ds->npreds && !search_test(ds, entry->type, NULL))
+			goto descend; /* told by d_type */
+		if (ds->needle && entry->type != DT_REG && entry->type != DT_UNKNOWN)
+			goto descend; /* only regular files are read */
+		if (ds->flags & SEARCH_INODE || needstat) {
+			/* d_type from readdir is enough otherwise */
+			status = search_lookup(dir, entry->name, entry->namelen, &ds->lookup);
+			if (status == -ENOENT)
+				goto out; /* gone since readdir */
+			if (status)
+				return status;
+			status = search_access(ds, &ds->lookup, &dir->fp->f_path, entry->name);
+			if (status > 0 && (ds->flags & SEARCH_METADATA || needstat))
+				status = vfs_getattr(ds->lookup.mnt, ds->lookup.dentry, &ds->stat) ?: search_test(ds, entry->type, &ds->stat);
+			path_put(&ds->lookup);
+			if (status < 0)
+				return status;
+			if (status == 0)
+				goto descend; /* not for the caller to use, its entries may be */
+		}
+		if (ds->needle) {
+			/* last, it is the dearest */
+			status = ds->stat.mode && !S_ISREG(ds->stat.mode) ? 0 : search_content(ds, &dir->fp->f_path, entry->name);
+			if (status < 0)
+				return status;
+			if (status == 0)
+				goto descend;
+		}
+		if (ds->flags & SEARCH_INCLUDEROOT)
+			status = copy_search_result(ds, &ds->next, &ds->len, ds->path, entry->type, &ds->stat);
+		else
+			status = copy_search_result(ds, &ds->next, &ds->len, entry->name, entry->type, &ds->stat);
+		if (status)
+			return status;
+		ds->results += 1;
+		ds->total += 1;
+		if (ds->pool && ds->args.max_results) {
+			status = search_flush(ds->worker); /* the caller counts results by the chunk */
+			if (status)
+				return status;
+		}
+		if (ds->flags & SEARCH_STOPATFIRST)
+			return 0;
+	}
+descend:
+	if (ds->args.max_depth && depth >= ds->args.max_depth)
+		goto out; /* its entries would be too deep */
+	if (ds->flags & SEARCH_PERIOD && entry->name[0] == '.' && !(how & SEARCH_MATCH_PARTIAL))
+		goto out; /* hidden, and the pattern does not name it */
+	if (entry->type == DT_DIR && strcmp(entry->name, ".") != 0 && strcmp(entry->name, "..") != 0 && (how & SEARCH_MATCH_PARTIAL || ds->isrecursive))
+		return search_descend(ds); /* ds->path names the new top of stack, if any */
+	/* else SEARCH_MATCH_FAILURE */
+out:
+	search_path_pop(ds);
+	return 0;
+}
+
+/*
+ * First entry of a frame repositioned from the cursor: above the deepest
+ * level it is the directory we were inside of, and it was already
+ * matched, so only descend into it again.
+ */
+static int search_resume (struct dir_search *ds, struct search_directory *dir, const struct search_entry *entry)
+{
+	int depth = ds->depth;
+	int status;
+
+	if (depth < ds->cursor.depth && entry->type == DT_DIR && search_name(ds, dir, entry) == 0) {
+		match_entry(ds->match, dir->state, ds->state, entry->name);
+		status = search_descend(ds);
+		if (status || ds->depth > depth)
+			return status;
+	}
+
+	/* the tree changed under the cursor, carry on from here */
+	ds->cursor.depth = 0;
+	return search_entry(ds, dir, entry);
+}
+
+/* Record where the traversal stopped so that the next call can pick up from there. */
+static void search_save (struct dir_search *ds)
+{
+	int n;
+
+	if (ds->depth > SEARCH_CURSOR_DEPTH)
+		return; /* too deep to describe, the caller gets -ERANGE */
+
+	ds->cursor.state = SEARCH_CURSOR_MORE;
+	ds->cursor.root = ds->root;
+	ds->cursor.depth = ds->depth;
+	ds->cursor.results = ds->total;
+	for (n = 0; n < ds->depth; n++)
+		ds->cursor.pos[n] = ds->dirs[n].pos;
+}
+
+/*
+ * Walk the tree below the directories on the stack depth-first, using
+ * ds->dirs as an explicit stack.  When the buffer fills up (or the
+ * deadline passes) the stack is kept, with the entry that did not fit up
+ * next, so that the walk can be continued.
+ */
+static int search_walk (struct dir_search *ds)
+{
+	int stepped = 0;
+	int status = 0;
+
+	while (status == 0 && ds->depth > 0) {
+		struct search_directory *dir = &ds->dirs[ds->depth-1];
+		struct search_entry *entry;
+
+		if (dir->entry == dir->next) {
+			status = search_fill(ds, dir);
+			if (status == 0 && dir->entry == dir->next) {
+				if (dir->resume)
+					ds->cursor.depth = 0; /* nothing left where the cursor pointed */
+				search_pop(ds);
+			}
+			continue;
+		}
+
+		/* step past the entry first, search_entry may grow ds->dirs */
+		entry = (struct search_entry *) dir->entry;
+		dir->entry += search_entry_size(entry->namelen);
+		dir->pos = entry->offset;
+
+		/* long walks of a warm dcache must not hog the CPU or outlive a kill */
+		ds->visited += 1;
+		cond_resched();
+		if (fatal_signal_pending(current) || ACCESS_ONCE(ds->cancel)) {
+			status = -EINTR; /* a kworker gets no signal, see search_aio_cancel */
+			break;
+		}
+
+		/* out of time: stop as for a full buffer, after one entry at least */
+		if (!dir->resume && stepped++ && search_expired(ds)) {
+			dir->entry = (char *) entry;
+			return -ETIME;
+		}
+
+		if (dir->resume) {
+			dir->resume = 0;
+			status = search_resume(ds, dir, entry);
+		} else if (!entry->skip) {
+			status = search_entry(ds, dir, entry);
+		}
+
+		if (status == -ERANGE) {
+			dir->entry = (char *) entry; /* not copied out, it goes first next time */
+			return status;
+		}
+
+		/* check if we found something and STOPATFIRST is set */
+		if (ds->results > 0 && ds->flags & SEARCH_STOPATFIRST)
+			break;
+		if (!ds->pool && search_full(ds))
+			break;
+		if (ds->pool && ACCESS_ONCE(ds->pool->stop))
+			break;
+	}
+
+	while (ds->depth > 0)
+		search_pop(ds);
+	return status;
+}
+
+/* Open the current root and canonicalize its name, below it ds->path is built by search_name. */
+static struct file *search_open_root (struct dir_search *ds, struct search_root *root)
+{
+	struct file *fp;
+	int status;
+
+	if (root->status)
+		return ERR_PTR(root->status);
+	fp = file_open_root(root->path.dentry, root->path.mnt, ".", O_DIRECTORY|O_RDONLY|O_LARGEFILE);
+	if (IS_ERR(fp))
+		return fp;
+	status = abspath(&fp->f_path, ds->path);
+	if (status) {
+		filp_close(fp, current->files);
+		return ERR_PTR(status);
+	}
+	ds->base = ds->pathlen = strlen(ds->path);
+	bitmap_copy(ds->state, ds->match->start, ds->match->npos);
+	return fp;
+}
+
+/* Search below the current root, or carry on where the buffer filled up. */
+static int search_directory (struct dir_search *ds)
+{
+	int status = 0;
+
+	//printk("search_directory(%p, %zu, %p:\"%s\", %p:\"%s\", %d, %zu, %p)\n", ds, ds->base, ds->path, ds->path, ds->pattern, ds->pattern, ds->flags, ds->len, ds->buf);
+
+	if (ds->depth == 0)
+		status = search_push(ds, search_open_root(ds, &ds->roots[ds->root]));
+	if (status)
+		return status;
+	return search_walk(ds);
+}
+
+/* Pattern without wildcards: look it up below the root directly. */
+static int search_literal (struct dir_search *ds)
+{
+	struct search_root *root = &ds->roots[ds->root];
+	unsigned char type;
+	int status = root->status;
+	int depth = 0;
+	char *c;
+
+	if (status == -ENOENT)
+		return 0;
+	else if (status)
+		return status;
+
+	for (c = ds->pattern; *c; c++) {
+		if (*c != '/' && (c == ds->pattern || c[-1] == '/'))
+			depth += 1;
+	}
+	if (depth < ds->args.min_depth || (ds->args.max_depth && depth > ds->args.max_depth))
+		return 0;
+
+	ds->base = strlen(root->name);
+	if (ds->base+1+strlen(ds->pattern) > PATH_MAX)
+		return -ENAMETOOLONG;
+	strcpy(ds->path, root->name);
+	strcat(ds->path, "/");
+	strcat(ds->path, ds->pattern);
+
+	status = vfs_path_lookup(root->path.dentry, root->path.mnt, ds->pattern, 0, &ds->psearch.path);
+	if (status == -ENOENT)
+		return 0;
+	else if (status)
+		return status;
+	memset(&ds->psearch.stat, 0, sizeof(struct kstat));
+	status = search_access(ds, &ds->psearch.path, &root->path, ds->pattern);
+	if (status > 0 && (ds->flags & SEARCH_METADATA || ds->npreds))
+		status = vfs_getattr(ds->psearch.path.mnt, ds->psearch.path.dentry, &ds->psearch.stat) ?: search_test(ds, DT_UNKNOWN, &ds->psearch.stat);
+	type = (ds->psearch.path.dentry->d_inode->i_mode >> 12) & 15;
+	path_put(&ds->psearch.path);
+	if (status <= 0)
+		return status; /* 0: not for the caller to use */
+	if (ds->needle) {
+		status = type == DT_REG ? search_content(ds, &root->path, ds->pattern) : 0;
+		if (status <= 0)
+			return status;
+	}
+	if (ds->flags & SEARCH_INCLUDEROOT)
+		status = copy_search_result(ds, &ds->next, &ds->len, ds->path, type, &ds->psearch.stat);
+	else
+		status = copy_search_result(ds, &ds->next, &ds->len, ds->path+ds->base, type, &ds->psearch.stat);
+	if (status)
+		return status;
+	ds->results += 1;
+	ds->total += 1;
+	return 0;
+}
+
+/* Search the roots from ds->root on; -ERANGE leaves the search where it stopped. */
+static int search_run (struct dir_search *ds)
+{
+	int status;
+
+	for (; ds->root < ds->nroots; ds->root++) {
+		if (ds->root != ds->cursor.root)
+			ds->cursor.depth = 0;
+		if (ds->ispattern)
+			status = search_directory(ds);
+		else
+			status = search_literal(ds);
+		if (status)
+			return status;
+		if ((ds->results > 0 && ds->flags & SEARCH_STOPATFIRST) || search_full(ds)) {
+			ds->root = ds->nroots;
+			break;
+		}
+	}
+	return 0;
+}
+
+/* Copy in paths and pattern, analyze the pattern and look up the roots. */
+static int search_setup (struct dir_search *ds, const char __user *paths, const char __user *pattern, int flags)
+{
+	char *c;
+	char *n;
+	int i;
+
+	mutex_init(&ds->lock);
+	get_fs_root(current->fs, &ds->fsroot); /* for the symlinks search_access follows */
+
+	ds->paths = getname(paths);
+	if (IS_ERR(ds->paths)) {
+		int status = PTR_ERR(ds->paths);
+		ds->paths = NULL;
+		return status;
+	}
+
+	ds->pattern = getname(pattern);
+	if (IS_ERR(ds->pattern)) {
+		int status = PTR_ERR(ds->pattern);
+		ds->pattern = NULL;
+		return status;
+	}
+
+	ds->flags = flags;
+	ds->stage = kmalloc(SEARCH_STAGE_SIZE, GFP_KERNEL | __GFP_NOWARN); /* without, results are copied out one by one */
+
+	ds->isrecursive = isrecursive(ds->pattern) || flags & SEARCH_REGEX;
+	ds->ispattern = ispattern(ds->pattern) || flags & (SEARCH_ICASE|SEARCH_REGEX); /* a literal is looked up as is */
+
+	if (ds->ispattern) {
+		ds->match = search_compile(ds->pattern, ds->flags);
+		if (IS_ERR(ds->match)) {
+			int status = PTR_ERR(ds->match);
+			ds->match = NULL;
+			return status;
+		}
+		ds->state = kmalloc(2*search_pattern_words(ds->match->npos)*sizeof(long), GFP_KERNEL);
+		if (!ds->state)
+			return -ENOMEM;
+	} else {
+		/* remove leading forward slashes */
+		for (c = ds->pattern; *c == '/'; c++)
+			;
+		memmove(ds->pattern, c, strlen(c)+1);
+	}
+
+	ds->nroots = 1;
+	for (c = ds->paths; (c = strchr(c, '|')) != NULL; c++)
+		ds->nroots += 1;
+	ds->roots = kcalloc(ds->nroots, sizeof(struct search_root), GFP_KERNEL);
+	if (!ds->roots)
+		return -ENOMEM;
+
+	n = ds->paths;
+	for (i = 0; (c = strsep(&n, "|")) != NULL; i++) {
+		ds->roots[i].name = c;
+		ds->roots[i].status = kern_path(c, LOOKUP_FOLLOW, &ds->roots[i].path);
+	}
+
+	//printk("search(%p:\"%s\", %p:\"%s\", %d)\n", paths, ds->paths, pattern, ds->pattern, ds->flags);
+	return 0;
+}
+
+/* Close what is left on the stack and free the frames. */
+static void search_release_walk (struct dir_search *ds)
+{
+	while (ds->depth > 0)
+		search_pop(ds);
+	while (ds->ndirs > 0) {
+		ds->ndirs -= 1;
+		kfree(ds->dirs[ds->ndirs].entries);
+		kfree(ds->dirs[ds->ndirs].state);
+	}
+	kfree(ds->dirs);
+	kfree(ds->cand);
+	ds->cand = NULL;
+	search_dfa_free(ds->dfa);
+	ds->dfa = NULL;
+}
+
+static void search_release (struct dir_search *ds)
+{
+	int i;
+
+	search_release_walk(ds);
+
+	for (i = 0; ds->roots && i < ds->nroots; i++) {
+		if (!ds->roots[i].status)
+			path_put(&ds->roots[i].path);
+	}
+	kfree(ds->roots);
+
+	kfree(ds->stage);
+	kfree(ds->state);
+	if (ds->match)
+		kfree(ds->match->regex);
+	kfree(ds->match);
+	kfree(ds->preds);
+#ifdef CONFIG_TEXTSEARCH
+	if (ds->needle)
+		textsearch_destroy(ds->needle);
+#endif
+	if (ds->pattern)
+		putname(ds->pattern);
+	if (ds->paths)
+		putname(ds->paths);
+	if (ds->fsroot.mnt)
+		path_put(&ds->fsroot);
+	kfree(ds);
+}
+
+/* End a pooled search early, keeping the first error. */
+static void search_stop (struct search_pool *pool, int status)
+{
+	spin_lock(&pool->lock);
+	if (status && !pool->status)
+		pool->status = status;
+	pool->stop = 1;
+	spin_unlock(&pool->lock);
+	wake_up_all(&pool->wait);
+}
+
+/* Next unit for a worker; NULL once every unit is walked or the search is stopped. */
+static struct search_unit *search_take (struct search_pool *pool)
+{
+	struct search_unit *unit = NULL;
+
+	spin_lock(&pool->lock);
+	while (!pool->stop && pool->pending > 0 && list_empty(&pool->units)) {
+		pool->idle += 1;
+		spin_unlock(&pool->lock);
+		wait_event_interruptible(pool->wait, pool->stop || pool->pending == 0 || !list_empty(&pool->units));
+		spin_lock(&pool->lock);
+		pool->idle -= 1;
+	}
+	if (!pool->stop && !list_empty(&pool->units)) {
+		unit = list_first_entry(&pool->units, struct search_unit, list);
+		list_del(&unit->list);
+		pool->queued -= 1;
+	}
+	spin_unlock(&pool->lock);
+	return unit;
+}
+
+/* A unit has been walked and its results flushed, its subdirectories were walked or queued along the way. */
+static void search_done (struct search_pool *pool, struct search_unit *unit, int status)
+{
+	int wake;
+
+	spin_lock(&pool->lock);
+	pool->pending -= 1;
+	pool->remaining[unit->root] -= 1;
+	if (status && !pool->status)
+		pool->status = status;
+	if (status)
+		pool->stop = 1;
+	wake = pool->stop || pool->pending == 0;
+	spin_unlock(&pool->lock);
+	if (wake)
+		wake_up_all(&pool->wait);
+	wake_up(&pool->drain); /* the root may be finished */
+}
+
+/* Start the worker's chunk over, it is kept from unit to unit. */
+static void search_chunk_reset (struct search_worker *w)
+{
+	struct dir_search *ds = w->ds;
+
+	ds->buf = ds->next = (char __user __force *) w->chunk->data;
+	ds->len = SEARCH_CHUNK_SIZE;
+	ds->results = 0;
+}
+
+/*
+ * Hand what went into the worker's chunk to the caller, in a chunk of its
+ * own size: with max_results that is one result, not SEARCH_BUF_MAX.  For
+ * a root after the one being copied out, wait for room first.
+ */
+static int search_flush (struct search_worker *w)
+{
+	struct search_pool *pool = w->pool;
+	struct dir_search *ds = w->ds;
+	size_t len = ds->next - ds->buf;
+	size_t nul = ds->flags & SEARCH_BINARY ? 0 : 2; /* see search_drain */
+	struct search_chunk *chunk;
+
+	if (len == 0)
+		return 0;
+	spin_lock(&pool->lock);
+	while (!pool->stop && ds->root != pool->emit && pool->bytes+len > pool->room) {
+		spin_unlock(&pool->lock);
+		wait_event_interruptible(pool->wait, pool->stop || ds->root == pool->emit || pool->bytes+len <= pool->room);
+		spin_lock(&pool->lock);
+	}
+	if (pool->stop) {
+		spin_unlock(&pool->lock);
+		return -ESRCH; /* nobody wants them */
+	}
+	pool->bytes += len;
+	spin_unlock(&pool->lock);
+
+	chunk = kmalloc(sizeof(struct search_chunk)+len+nul, GFP_KERNEL);
+	if (!chunk) {
+		spin_lock(&pool->lock);
+		pool->bytes -= len;
+		spin_unlock(&pool->lock);
+		return -ENOMEM;
+	}
+	memcpy(chunk->data, w->chunk->data, len+nul);
+	chunk->root = ds->root;
+	chunk->len = len;
+	chunk->results = ds->results;
+	search_chunk_reset(w);
+
+	spin_lock(&pool->lock);
+	list_add_tail(&chunk->list, &pool->chunks);
+	spin_unlock(&pool->lock);
+	wake_up(&pool->drain);
+	return 0;
+}
+
+static void search_worker (struct work_struct *work)
+{
+	struct search_worker *w = container_of(work, struct search_worker, work);
+	struct search_pool *pool = w->pool;
+	struct dir_search *ds = w->ds;
+	const struct cred *cred = override_creds(pool->cred);
+	struct search_unit *unit;
+
+	w->chunk = kmalloc(SEARCH_BUF_MAX, GFP_KERNEL);
+	if (!w->chunk)
+		search_stop(pool, -ENOMEM);
+	else
+		search_chunk_reset(w);
+
+	while ((unit = search_take(pool)) != NULL) {
+		int status;
+
+		ds->root = unit->root;
+		ds->level = unit->level;
+		memcpy(ds->path, unit->path, unit->pathlen+1);
+		ds->pathlen = unit->pathlen;
+		ds->base = unit->base;
+		bitmap_copy(ds->state, unit->state, ds->match->npos);
+		status = search_push(ds, unit->fp);
+
+		while (status == 0 && ds->depth > 0) {
+			status = search_walk(ds);
+			if (status == -ERANGE)
+				status = ds->next > ds->buf ? search_flush(w) : -EINVAL; /* or a result larger than a chunk */
+		}
+		while (ds->depth > 0)
+			search_pop(ds); /* left by an error after -ERANGE */
+		if (status == 0)
+			status = search_flush(w); /* before the root can be seen as finished */
+		search_chunk_reset(w);
+		search_done(pool, unit, status);
+		kfree(unit);
+	}
+
+	kfree(w->chunk);
+	w->chunk = NULL;
+	revert_creds(cred);
+
+	spin_lock(&pool->lock);
+	pool->running -= 1;
+	spin_unlock(&pool->lock);
+	wake_up(&pool->drain);
+}
+
+/* Copy a chunk out to the user buffer, the text format needs room for its double NUL. */
+static int search_drain (struct dir_search *ds, struct search_chunk *chunk)
+{
+	size_t len = chunk->len + (ds->flags & SEARCH_BINARY ? 0 : 2);
+
+	if (search_full(ds))
+		return 0; /* with max_results, a chunk holds one result */
+	if (len > ds->len)
+		return -ERANGE;
+	if (copy_to_user(ds->next, chunk->data, len))
+		return -EFAULT;
+	ds->next += chunk->len;
+	ds->len -= chunk->len;
+	ds->results += chunk->results;
+	ds->total += chunk->results;
+	return 0;
+}
+
+/* A worker's copy of the search, sharing the pattern with the caller. */
+static struct dir_search *search_clone (struct dir_search *ds, struct search_pool *pool)
+{
+	struct dir_search *clone;
+
+	clone = kzalloc(sizeof(struct dir_search), GFP_KERNEL);
+	if (!clone)
+		return NULL;
+	clone->state = kmalloc(2*search_pattern_words(ds->match->npos)*sizeof(long), GFP_KERNEL);
+	if (!clone->state) {
+		kfree(clone);
+		return NULL;
+	}
+	clone->pattern = ds->pattern;
+	clone->flags = ds->flags;
+	clone->isrecursive = ds->isrecursive;
+	clone->ispattern = ds->ispattern;
+	clone->match = ds->match;
+	clone->args = ds->args;
+	clone->preds = ds->preds;
+	clone->npreds = ds->npreds;
+	clone->statpreds = ds->statpreds;
+	clone->needle = ds->needle;
+	clone->fsroot = ds->fsroot;
+	clone->pool = pool;
+	return clone;
+}
+
+static struct search_pool *search_pool_alloc (struct dir_search *ds, int nworkers)
+{
+	struct search_pool *pool;
+	int i;
+
+	pool = kzalloc(sizeof(struct search_pool)+nworkers*sizeof(struct search_worker), GFP_KERNEL);
+	if (!pool)
+		return NULL;
+	pool->remaining = kcalloc(ds->nroots, sizeof(int), GFP_KERNEL);
+	pool->held = kmalloc(ds->nroots*sizeof(struct list_head), GFP_KERNEL);
+	if (!pool->remaining || !pool->held) {
+		kfree(pool->remaining);
+		kfree(pool->held);
+		kfree(pool);
+		return NULL;
+	}
+	for (i = 0; i < ds->nroots; i++)
+		INIT_LIST_HEAD(&pool->held[i]);
+	spin_lock_init(&pool->lock);
+	INIT_LIST_HEAD(&pool->units);
+	INIT_LIST_HEAD(&pool->chunks);
+	init_waitqueue_head(&pool->wait);
+	init_waitqueue_head(&pool->drain);
+	pool->cred = get_current_cred();
+	return pool;
+}
+
+static void search_pool_free (struct dir_search *ds, struct search_pool *pool)
+{
+	struct search_unit *unit, *u;
+	struct search_chunk *chunk, *c;
+	int i;
+
+	for (i = 0; i < pool->nworkers; i++) {
+		flush_work(&pool->workers[i].work);
+		ds->visited += pool->workers[i].ds->visited;
+		search_release_walk(pool->workers[i].ds);
+		kfree(pool->workers[i].ds->state);
+		kfree(pool->workers[i].ds);
+	}
+	list_for_each_entry_safe(unit, u, &pool->units, list) {
+		filp_close(unit->fp, current->files);
+		kfree(unit);
+	}
+	for (i = 0; i < ds->nroots; i++) {
+		list_for_each_entry_safe(chunk, c, &pool->held[i], list)
+			kfree(chunk);
+	}
+	put_cred(pool->cred);
+	kfree(pool->remaining);
+	kfree(pool->held);
+	kfree(pool);
+}
+
+/*
+ * Queue the roots, let the workers walk them and copy their chunks out as
+ * they come in: those of the first root that is not finished right away,
+ * those of the following ones once it is.  STOPATFIRST thus still stops
+ * at the first root with a match.  Within a root, SEARCH_PARALLEL results
+ * are in the order the workers found them.
+ */
+static int search_concurrent (struct dir_search *ds)
+{
+	int nworkers = ds->nroots;
+	struct search_pool *pool;
+	int emit = 0; /* first root not copied out completely */
+	int killed = 0;
+	int status = 0;
+	int i;
+
+	if (ds->flags & SEARCH_PARALLEL)
+		nworkers = max_t(int, nworkers, num_online_cpus());
+	nworkers = min(nworkers, SEARCH_WORKERS);
+	pool = search_pool_alloc(ds, nworkers);
+	if (!pool)
+		return -ENOMEM;
+
+	for (ds->root = 0; status == 0 && ds->root < ds->nroots; ds->root++) {
+		struct file *fp = search_open_root(ds, &ds->roots[ds->root]);
+
+		if (IS_ERR(fp)) {
+			status = PTR_ERR(fp);
+			if (status == -ENOENT || status == -EPERM || status == -EACCES || status == -ENODEV)
+				status = 0; /* as search_push */
+			continue;
+		}
+		status = search_queue(pool, ds, fp);
+		if (status)
+			filp_close(fp, current->files);
+	}
+
+	for (i = 0; status == 0 && i < min(nworkers, pool->pending); i++) {
+		struct search_worker *w = &pool->workers[i];
+
+		w->ds = search_clone(ds, pool);
+		if (!w->ds)
+			break; /* fewer workers */
+		w->ds->worker = w;
+		w->pool = pool;
+		INIT_WORK(&w->work, search_worker);
+		pool->nworkers += 1;
+	}
+	if (status == 0 && pool->pending > 0 && pool->nworkers == 0)
+		status = -ENOMEM;
+	if (status)
+		pool->stop = 1;
+
+	pool->room = ds->len;
+	pool->running = pool->nworkers;
+	for (i = 0; i < pool->nworkers; i++)
+		queue_work(system_unbound_wq, &pool->workers[i].work);
+
+	for (;;) {
+		struct search_chunk *chunk, *c;
+		LIST_HEAD(chunks);
+		size_t freed = 0;
+		int finished;
+		int running;
+
+		if (killed)
+			wait_event(pool->drain, !list_empty(&pool->chunks) || !pool->running);
+		else if (wait_event_killable(pool->drain, !list_empty(&pool->chunks) || !pool->running || (emit < ds->nroots && !pool->remaining[emit]))) {
+			killed = 1;
+			search_stop(pool, -EINTR);
+			continue;
+		}
+
+		spin_lock(&pool->lock);
+		list_splice_init(&pool->chunks, &chunks);
+		running = pool->running;
+		for (finished = emit; finished < ds->nroots && !pool->remaining[finished]; finished++)
+			;
+		spin_unlock(&pool->lock);
+
+		list_for_each_entry_safe(chunk, c, &chunks, list)
+			list_move_tail(&chunk->list, &pool->held[chunk->root]);
+
+		/* the finished roots, then what there is of the next one */
+		for (; status == 0 && emit <= finished && emit < ds->nroots; emit++) {
+			/*
+			 * Test after every chunk: with STOPATFIRST one holds a
+			 * single result, search_walk stops a unit at its first,
+			 * but several workers may have flushed one for the root.
+			 */
+			list_for_each_entry_safe(chunk, c, &pool->held[emit], list) {
+				if (status == 0)
+					status = search_drain(ds, chunk);
+				if (status == 0 && ((ds->results > 0 && ds->flags & SEARCH_STOPATFIRST) || search_full(ds)))
+					status = -ESRCH; /* not an error, just stop */
+				freed += chunk->len;
+				list_del(&chunk->list);
+				kfree(chunk);
+			}
+			if (emit == finished)
+				break;
+		}
+		if (status) {
+			/* nothing more goes out, let go of what is held right away */
+			for (i = 0; i < ds->nroots; i++) {
+				list_for_each_entry_safe(chunk, c, &pool->held[i], list) {
+					freed += chunk->len;
+					list_del(&chunk->list);
+					kfree(chunk);
+				}
+			}
+		}
+
+		spin_lock(&pool->lock);
+		pool->bytes -= freed;
+		pool->room = ds->len;
+		pool->emit = emit;
+		spin_unlock(&pool->lock);
+		if (status)
+			search_stop(pool, status);
+		else
+			wake_up_all(&pool->wait); /* room, or the next root */
+		if (!running)
+			break; /* a worker's chunks are queued before it exits */
+	}
+
+	if (status == -ESRCH)
+		status = 0;
+	else if (!status)
+		status = pool->status;
+	search_pool_free(ds, pool);
+	ds->root = ds->nroots;
+	return status;
+}
+
+/*
+ * Copy in struct search_args, of whatever size the caller was built with:
+ * a shorter one is zero-extended, a longer one has to be zero beyond ours.
+ */
+static int search_copy_args (struct search_args *args, const struct search_args __user *uargs)
+{
+	u32 size;
+	int status;
+
+	if (get_user(size, &uargs->size))
+		return -EFAULT;
+	if (size < SEARCH_ARGS_SIZE_VER0 || size > PAGE_SIZE)
+		return -EINVAL;
+	if (size > sizeof(struct search_args)) {
+		const unsigned char __user *c = (const unsigned char __user *) uargs;
+		size_t i;
+
+		for (i = sizeof(struct search_args); i < size; i++) {
+			unsigned char v;
+
+			status = get_user(v, c+i);
+			if (status)
+				return status;
+			if (v)
+				return -E2BIG;
+		}
+		size = sizeof(struct search_args);
+	}
+	memset(args, 0, sizeof(struct search_args));
+	if (copy_from_user(args, uargs, size))
+		return -EFAULT;
+	args->size = size;
+	return 0;
+}
+
+/* Copy in and check the predicates of ds->args. */
+static int search_copy_predicates (struct dir_search *ds)
+{
+	const struct search_predicate __user *upreds = (const struct search_predicate __user *) (unsigned long) ds->args.predicates;
+	int i;
+
+	if (!ds->args.npredicates)
+		return 0;
+	if (ds->args.npredicates > SEARCH_PREDICATES_MAX)
+		return -E2BIG;
+	ds->preds = kmalloc(ds->args.npredicates*sizeof(struct search_predicate), GFP_KERNEL);
+	if (!ds->preds)
+		return -ENOMEM;
+	if (copy_from_user(ds->preds, upreds, ds->args.npredicates*sizeof(struct search_predicate)))
+		return -EFAULT;
+	ds->npreds = ds->args.npredicates;
+
+	for (i = 0; i < ds->npreds; i++) {
+		const struct search_predicate *pred = &ds->preds[i];
+
+		if (pred->field > SEARCH_FIELD_PERM || pred->op > SEARCH_CMP_ANY || pred->__pad)
+			return -EINVAL;
+		if (pred->field != SEARCH_FIELD_TYPE)
+			ds->statpreds = 1;
+	}
+	return 0;
+}
+
+/* The last argument is a struct search_args with SEARCH_ARGS, else the struct search_cursor for SEARCH_CURSOR. */
+SYSCALL_DEFINE6(search, const char __user *, paths, const char __user *, pattern, int, flags, char __user *, buf, size_t, len, void __user *, arg)
+{
+	//printk("paths: %s, pattern: %s, flags: %d\n", paths, pattern, flags);
+
+	int status = 0;
+	struct dir_search *ds;
+	struct search_cursor __user *cursor = arg;
+
+	if (!access_ok(VERIFY_WRITE, buf, len))
+		return -EFAULT;
+	if (flags & SEARCH_PARALLEL && flags & SEARCH_CURSOR)
+		return -EINVAL; /* workers finish in no particular order */
+
+	ds = kzalloc(sizeof(struct dir_search), GFP_KERNEL);
+	if (!ds)
+		return -ENOMEM;
+
+	status = search_setup(ds, paths, pattern, flags);
+	if (status)
+		goto exit;
+
+	ds->buf = ds->next = buf;
+	ds->len = len;
+
+	if (ds->flags & SEARCH_ARGS) {
+		status = search_copy_args(&ds->args, arg);
+		if (!status)
+			status = search_copy_predicates(ds);
+		if (!status)
+			status = search_copy_needle(ds);
+		if (status)
+			goto exit;
+		cursor = (struct search_cursor __user *) (unsigned long) ds->args.cursor;
+		if (ds->args.timeout_ns && !(ds->flags & SEARCH_CURSOR)) {
+			status = -EINVAL; /* the rest could not be had */
+			goto exit;
+		}
+		search_set_deadline(ds);
+	}
+
+	if (ds->flags & SEARCH_CURSOR) {
+		if (copy_from_user(&ds->cursor, cursor, sizeof(struct search_cursor))) {
+			status = -EFAULT;
+			goto exit;
+		}
+		if (ds->cursor.state == SEARCH_CURSOR_DONE) {
+			status = 0;
+			goto exit;
+		}
+		if (ds->cursor.state != SEARCH_CURSOR_MORE && ds->cursor.state != SEARCH_CURSOR_EXPIRED)
+			ds->cursor.root = ds->cursor.depth = ds->cursor.results = 0;
+		if (ds->cursor.depth > SEARCH_CURSOR_DEPTH) {
+			status = -EINVAL;
+			goto exit;
+		}
+		ds->cursor.state = SEARCH_CURSOR_START; /* until search_save */
+		ds->root = ds->cursor.root;
+		ds->total = ds->cursor.results;
+	}
+
+	if (ds->ispattern && (ds->flags & SEARCH_PARALLEL || (ds->nroots > 1 && !(ds->flags & SEARCH_CURSOR))))
+		status = search_concurrent(ds);
+	else
+		status = search_run(ds);
+	if ((status == -ERANGE || status == -ETIME) && ds->flags & SEARCH_CURSOR)
+		search_save(ds);
+
+	if (status == -ETIME && ds->cursor.state == SEARCH_CURSOR_MORE) {
+		ds->cursor.state = SEARCH_CURSOR_EXPIRED;
+		status = 0; /* what there is so far, the rest for the next call */
+	} else if (status == -ERANGE && ds->cursor.state == SEARCH_CURSOR_MORE && ds->results > 0)
+		status = 0; /* the rest is for the next call */
+	else if (status)
+		goto exit;
+	else if (ds->flags & SEARCH_CURSOR)
+		ds->cursor.state = SEARCH_CURSOR_DONE;
+
+	if (ds->flags & SEARCH_CURSOR && copy_to_user(cursor, &ds->cursor, sizeof(struct search_cursor))) {
+		status = -EFAULT;
+		goto exit;
+	}
+	if (ds->args.size >= SEARCH_ARGS_SIZE_VER2 && put_user(ds->visited, &((struct search_args __user *) arg)->visited)) {
+		status = -EFAULT;
+		goto exit;
+	}
+
+	if (ds->buf != ds->next && !(ds->flags & SEARCH_BINARY)) {
+		/* this is a sad hack because the '|' delimiter design
+		 * makes programming this rather difficult.
+		 * We remove the final '|' that was added.
+		 */
+		if (search_copy(ds, ds->next-1, "\0\0", 2)) {
+			status = -EFAULT;
+			goto exit;
+		}
+	}
+	if (search_unstage(ds)) {
+		status = -EFAULT;
+		goto exit;
+	}
+	status = ds->results;
+
+	//printk("buffer: %s\n", buf);
+
+exit:
+	search_release(ds);
+	return status;
+}
+
+/*
+ * search_open(2) sessions: the search is set up once and its results are
+ * read() from the returned fd in chunks, like getdents.  Between reads the
+ * traversal stack stays in the kernel.
+ */
+static ssize_t search_session_read (struct file *file, char __user *buf, size_t len, loff_t *ppos)
+{
+	struct dir_search *ds = file->private_data;
+	const struct cred *cred;
+	ssize_t status;
+
+	if (!access_ok(VERIFY_WRITE, buf, len))
+		return -EFAULT;
+
+	mutex_lock(&ds->lock);
+	if (ds->ring) {
+		mutex_unlock(&ds->lock);
+		return -EBUSY; /* results go to the mapping */
+	}
+	cred = override_creds(file->f_cred); /* permissions are those of the opener */
+
+	ds->buf = ds->next = buf;
+	ds->len = len;
+	ds->results = 0;
+	search_set_deadline(ds);
+
+	status = search_run(ds);
+	if (search_unstage(ds) && (status == 0 || status == -ERANGE))
+		status = -EFAULT;
+	if (status == -ERANGE)
+		status = ds->next > ds->buf ? 0 : -EINVAL; /* result too large for the buffer */
+	else if (status == -ETIME)
+		status = ds->next > ds->buf ? 0 : -ETIME; /* nothing yet, but the session goes on */
+	else if (status)
+		ds->root = ds->nroots; /* hard error, end of the session */
+	if (status == 0)
+		status = ds->next - ds->buf;
+
+	revert_creds(cred);
+	mutex_unlock(&ds->lock);
+	return status;
+}
+
+/*
+ * Walk into the ring for as long as there is room.  A record that does
+ * not fit before the end of the area is preceded by padding.
+ */
+static void search_ring_walk (struct work_struct *work)
+{
+	struct dir_search *ds = container_of(work, struct dir_search, ringwork);
+	struct search_ring *ring = ds->ring;
+	const struct cred *cred;
+	int status;
+
+	mutex_lock(&ds->lock);
+	cred = override_creds(ds->ringcred);
+
+	for (;;) {
+		u32 tail = ACCESS_ONCE(ring->tail);
+		u32 used = ds->ringhead - tail;
+		u32 pos = ds->ringhead & (ds->ringsize-1);
+		u32 room;
+
+		if (used > ds->ringsize) {
+			status = -EINVAL; /* not a tail we gave out */
+			break;
+		}
+		room = min(ds->ringsize-used, ds->ringsize-pos);
+		ds->buf = ds->next = (char __user __force *) ds->ringdata+pos;
+		ds->len = room;
+
+		status = search_run(ds);
+		if (status != -ERANGE)
+			break;
+		if (ds->next > ds->buf)
+			continue; /* the consumer may have made more room */
+
+		if (room < ds->ringsize-used) {
+			struct search_record *pad = (struct search_record *) (ds->ringdata+pos);
+
+			/* room is less than a record, and a multiple of 8 */
+			pad->reclen = room;
+			pad->namelen = 0;
+			pad->type = DT_UNKNOWN;
+			ds->ringhead += room;
+			smp_wmb();
+			ACCESS_ONCE(ring->head) = ds->ringhead;
+			continue;
+		}
+		if (used == 0) {
+			status = -EINVAL; /* a record larger than the ring */
+			break;
+		}
+
+		/* full: poll() requeues us, unless the consumer moved on already */
+		spin_lock(&ds->ringlock);
+		ds->stalled = ACCESS_ONCE(ring->tail) == tail;
+		spin_unlock(&ds->ringlock);
+		if (ds->stalled)
+			goto out;
+	}
+
+	ring->error = status;
+	smp_wmb();
+	ring->state = SEARCH_CURSOR_DONE;
+	ds->root = ds->nroots;
+out:
+	revert_creds(cred);
+	mutex_unlock(&ds->lock);
+	wake_up_interruptible(&ds->ringwait);
+}
+
+static int search_session_mmap (struct file *file, struct vm_area_struct *vma)
+{
+	struct dir_search *ds = file->private_data;
+	unsigned long size = vma->vm_end - vma->vm_start;
+	struct search_ring *ring;
+	int status;
+
+	if (!(ds->flags & SEARCH_BINARY) || vma->vm_pgoff != 0)
+		return -EINVAL;
+	if (size <= PAGE_SIZE || size-PAGE_SIZE > (1UL<<30) || !is_power_of_2(size-PAGE_SIZE))
+		return -EINVAL;
+
+	/*
+	 * Not mutex_lock: a read holding the session may be faulting on its
+	 * buffer, which needs the mmap_sem we are called with.
+	 */
+	if (!mutex_trylock(&ds->lock))
+		return -EBUSY; /* being read */
+	status = -EBUSY;
+	if (ds->ring || ds->depth > 0 || ds->root > 0)
+		goto out; /* mapped or read already */
+	status = -ENOMEM;
+	ring = vmalloc_user(size);
+	if (!ring)
+		goto out;
+	status = remap_vmalloc_range(vma, ring, 0);
+	if (status) {
+		vfree(ring);
+		goto out;
+	}
+
+	ring->size = size-PAGE_SIZE;
+	ring->state = SEARCH_CURSOR_MORE;
+	INIT_WORK(&ds->ringwork, search_ring_walk);
+	ds->ringcred = get_cred(file->f_cred); /* permissions are those of the opener */
+	ds->ringdata = (char *) ring + PAGE_SIZE;
+	ds->ringsize = ring->size;
+	smp_wmb(); /* for search_session_poll, which does not take ds->lock */
+	ACCESS_ONCE(ds->ring) = ring;
+	queue_work(system_unbound_wq, &ds->ringwork);
+out:
+	mutex_unlock(&ds->lock);
+	return status;
+}
+
+static unsigned int search_session_poll (struct file *file, poll_table *wait)
+{
+	struct dir_search *ds = file->private_data;
+	struct search_ring *ring;
+
+	poll_wait(file, &ds->ringwait, wait); /* even unmapped, for an mmap to come */
+	ring = ACCESS_ONCE(ds->ring);
+	if (!ring)
+		return POLLIN | POLLRDNORM; /* read() walks itself */
+	smp_rmb(); /* pairs with search_session_mmap */
+
+	spin_lock(&ds->ringlock);
+	if (ds->stalled) {
+		ds->stalled = 0;
+		queue_work(system_unbound_wq, &ds->ringwork);
+	}
+	spin_unlock(&ds->ringlock);
+
+	if (ds->ringhead != ACCESS_ONCE(ring->tail) || ACCESS_ONCE(ring->state) == SEARCH_CURSOR_DONE)
+		return POLLIN | POLLRDNORM;
+	return 0;
+}
+
+static int search_session_release (struct inode *inode, struct file *file)
+{
+	struct dir_search *ds = file->private_data;
+
+	if (ds->ring) {
+		ds->cancel = 1;
+		cancel_work_sync(&ds->ringwork);
+		put_cred(ds->ringcred);
+		vfree(ds->ring);
+	}
+	search_release(ds);
+	return 0;
+}
+
+static const struct file_operations search_session_fops = {
+	.read		= search_session_read,
+	.poll		= search_session_poll,
+	.mmap		= search_session_mmap,
+	.release	= search_session_release,
+	.llseek		= noop_llseek,
+};
+
+/*
+ * IOCB_CMD_SEARCH: a read of the session done by a worker in the
+ * submitter's mm, completed with the bytes read, 0 at the end.  The
+ * session keeps the position for the next one.  io_cancel, io_destroy
+ * and exit stop the walk with -EINTR, which ends the session.
+ */
+struct search_aio {
+	struct work_struct work;
+	struct kiocb *iocb;
+};
+
+static void search_aio_work (struct work_struct *work)
+{
+	struct search_aio *req = container_of(work, struct search_aio, work);
+	struct kiocb *iocb = req->iocb;
+	struct mm_struct *mm = iocb->ki_ctx->mm;
+	mm_segment_t oldfs = get_fs();
+	ssize_t status;
+
+	kfree(req);
+	set_fs(USER_DS);
+	use_mm(mm);
+	status = search_session_read(iocb->ki_filp, iocb->ki_buf, iocb->ki_left, NULL);
+	unuse_mm(mm);
+	set_fs(oldfs);
+	aio_complete(iocb, status, 0);
+}
+
+static int search_aio_cancel (struct kiocb *iocb, struct io_event *event)
+{
+	struct dir_search *ds = iocb->ki_filp->private_data;
+
+	ACCESS_ONCE(ds->cancel) = 1; /* search_walk stops at the next entry */
+	event->res = -EINTR;
+	aio_put_req(iocb); /* the reference the canceller took */
+	return 0;
+}
+
+ssize_t search_aio (struct kiocb *iocb)
+{
+	struct search_aio *req;
+
+	if (iocb->ki_filp->f_op != &search_session_fops || !iocb->ki_ctx)
+		return -EINVAL;
+	req = kmalloc(sizeof(struct search_aio), GFP_KERNEL);
+	if (!req)
+		return -ENOMEM;
+	INIT_WORK(&req->work, search_aio_work);
+	req->iocb = iocb;
+	iocb->ki_cancel = search_aio_cancel;
+	queue_work(system_unbound_wq, &req->work);
+	return -EIOCBQUEUED;
+}
+
+SYSCALL_DEFINE4(search_open, const char __user *, paths, const char __user *, pattern, int, flags, const struct search_args __user *, args)
+{
+	struct dir_search *ds;
+	int fd;
+
+	if (flags & SEARCH_CURSOR)
+		return -EINVAL; /* the session is the cursor */
+	if (flags & SEARCH_PARALLEL)
+		return -EINVAL;
+
+	ds = kzalloc(sizeof(struct dir_search), GFP_KERNEL);
+	if (!ds)
+		return -ENOMEM;
+
+	fd = search_setup(ds, paths, pattern, flags);
+	if (fd == 0 && flags & SEARCH_ARGS) {
+		fd = search_copy_args(&ds->args, args);
+		if (fd == 0 && ds->args.cursor)
+			fd = -EINVAL;
+		if (fd == 0)
+			fd = search_copy_predicates(ds);
+		if (fd == 0)
+			fd = search_copy_needle(ds);
+	}
+	spin_lock_init(&ds->ringlock);
+	init_waitqueue_head(&ds->ringwait); /* polled before any mmap() */
+	if (fd == 0)
+		fd = anon_inode_getfd("[search]", &search_session_fops, ds, O_RDONLY);
+	if (fd < 0)
+		search_release(ds);
+	return fd;
 }
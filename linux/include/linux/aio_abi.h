@@ -44,6 +44,7 @@ enum {
 	IOCB_CMD_NOOP = 6,
 	IOCB_CMD_PREADV = 7,
 	IOCB_CMD_PWRITEV = 8,
+	IOCB_CMD_SEARCH = 9, /* read of a search_open(2) session */
 };
 
 /*
@@ -0,0 +1,165 @@
+#ifndef _LINUX_SEARCH_H
+#define _LINUX_SEARCH_H
+
+#include <linux/types.h>
+
+/* flags for search(2) */
+#define SEARCH_STOPATFIRST (1<<0)
+#define SEARCH_METADATA    (1<<1)
+#define SEARCH_INCLUDEROOT (1<<2)
+#define SEARCH_PERIOD      (1<<3)
+#define SEARCH_R_OK        (1<<4)
+#define SEARCH_W_OK        (1<<5)
+#define SEARCH_X_OK        (1<<6)
+#define SEARCH_CURSOR      (1<<7) /* 6th argument is a struct search_cursor */
+#define SEARCH_BINARY      (1<<8) /* struct search_record results instead of text */
+#define SEARCH_PARALLEL    (1<<9) /* walk subdirectories on all CPUs, unordered within a root */
+#define SEARCH_ARGS        (1<<10) /* last argument is a struct search_args */
+#define SEARCH_ICASE       (1<<11) /* ASCII letters of the pattern match either case */
+#define SEARCH_REGEX       (1<<12) /* pattern is an extended regular expression on names */
+
+/*
+ * Continuation token for SEARCH_CURSOR.  Zero it before the first call;
+ * while state is SEARCH_CURSOR_MORE, call again with the same paths,
+ * pattern and flags to get the results that did not fit.
+ */
+#define SEARCH_CURSOR_DEPTH 64
+
+enum {
+	SEARCH_CURSOR_START,
+	SEARCH_CURSOR_MORE, /* the buffer filled up */
+	SEARCH_CURSOR_DONE,
+	SEARCH_CURSOR_EXPIRED, /* timeout_ns of struct search_args ran out */
+};
+
+struct search_cursor {
+	__u32 state;
+	__u32 root;   /* index of the root in paths */
+	__u32 depth;  /* valid entries of pos, 0 starts the root over */
+	__u32 results; /* returned so far, for max_results */
+	__u64 pos[SEARCH_CURSOR_DEPTH]; /* f_pos of the entry in progress at each level */
+};
+
+/*
+ * Extra arguments for SEARCH_ARGS.  Set size to sizeof(struct search_args)
+ * as built against, fields the kernel does not know must be zero.  The
+ * entries of a root are at depth 1.  Zero means no limit.
+ */
+struct search_args {
+	__u32 size;
+	__u32 max_results;
+	__u32 min_depth;   /* of the results */
+	__u32 max_depth;   /* of the results, deeper directories are not read */
+	__u64 cursor;      /* struct search_cursor * for SEARCH_CURSOR */
+	__u64 timeout_ns;  /* per call, search(2) needs SEARCH_CURSOR to go on */
+	__u64 visited;     /* written back by search(2): entries looked at */
+	__u64 predicates;  /* struct search_predicate *, all have to hold for a result */
+	__u32 npredicates;
+	__u32 __reserved;
+	__u64 needle;      /* only regular files with these needlelen bytes in them */
+	__u32 needlelen;
+	__u32 needleflags; /* SEARCH_NEEDLE_* */
+};
+
+#define SEARCH_ARGS_SIZE_VER0  24 /* first published struct */
+#define SEARCH_ARGS_SIZE_VER1  32 /* added timeout_ns */
+#define SEARCH_ARGS_SIZE_VER2  40 /* added visited */
+#define SEARCH_ARGS_SIZE_VER3  56 /* added predicates */
+#define SEARCH_ARGS_SIZE_VER4  72 /* added needle */
+
+/*
+ * The needle is looked for in the first 4GB of the file, through the page
+ * cache.  With SEARCH_NEEDLE_OFFSET, SEARCH_BINARY records end with where
+ * it was first found.
+ */
+#define SEARCH_NEEDLE_ICASE   (1<<0)
+#define SEARCH_NEEDLE_OFFSET  (1<<1)
+
+#define SEARCH_NEEDLE_MAX  4096
+
+/*
+ * A condition on the results, as find(1) tests: field op value.  Only
+ * SEARCH_FIELD_TYPE ones are answered without looking at the inode.
+ * Entries that fail are not results, directories are still searched.
+ */
+struct search_predicate {
+	__u16 field; /* SEARCH_FIELD_* */
+	__u16 op;    /* SEARCH_CMP_* */
+	__u32 __pad;
+	__u64 value;
+};
+
+enum {
+	SEARCH_FIELD_TYPE,  /* DT_* */
+	SEARCH_FIELD_SIZE,  /* bytes */
+	SEARCH_FIELD_MTIME, /* seconds since the epoch, signed */
+	SEARCH_FIELD_UID,
+	SEARCH_FIELD_GID,
+	SEARCH_FIELD_PERM,  /* mode & 07777 */
+};
+
+enum {
+	SEARCH_CMP_EQ,
+	SEARCH_CMP_NE,
+	SEARCH_CMP_LT,
+	SEARCH_CMP_GT,
+	SEARCH_CMP_ALL, /* all bits of value set in the field */
+	SEARCH_CMP_ANY, /* some bit of value set in the field */
+};
+
+#define SEARCH_PREDICATES_MAX 32
+
+/*
+ * SEARCH_BINARY result, 8 byte aligned.  The kstat fields are only filled
+ * in with SEARCH_METADATA and are zero otherwise.
+ */
+struct search_record {
+	__u16 reclen;  /* of the whole record, name and padding included */
+	__u16 namelen; /* without the terminating NUL */
+	__u8  type;    /* DT_* */
+	__u8  __pad[3];
+	__u64 dev;
+	__u64 ino;
+	__u64 rdev;
+	__u64 size;
+	__u64 blocks;
+	__s64 atime;
+	__s64 mtime;
+	__s64 ctime;
+	__u32 atime_nsec;
+	__u32 mtime_nsec;
+	__u32 ctime_nsec;
+	__u32 mode;
+	__u32 nlink;
+	__u32 uid;
+	__u32 gid;
+	__u32 blksize;
+	char name[];   /* NUL terminated */
+};
+
+#define SEARCH_RECLEN(namelen)  ((sizeof(struct search_record)+(namelen)+1+7) & ~7)
+#define SEARCH_RECORD_OFFSET(record)  (*(__u64 *) ((char *) (record)+(record)->reclen-8))
+
+/*
+ * A search_open(2) session with SEARCH_BINARY can be mmap()ed instead of
+ * read.  The first page is a struct search_ring, the rest, a power of two
+ * in size, holds the records the kernel writes as it walks.  The records
+ * from tail up to head (free running, modulo size) are ready; one with a
+ * namelen of 0 only pads to the end of the area.  Advance tail past what
+ * was consumed, and poll(2) the fd for more: the walk waits for room.
+ */
+struct search_ring {
+	__u32 head;  /* written by the kernel */
+	__u32 tail;  /* written by the user */
+	__u32 size;  /* of the record area */
+	__u32 state; /* SEARCH_CURSOR_MORE while walking, then SEARCH_CURSOR_DONE */
+	__s32 error; /* that ended the walk early */
+	__u32 __reserved;
+};
+
+#ifdef __KERNEL__
+struct kiocb;
+extern ssize_t search_aio(struct kiocb *iocb);
+#endif
+
+#endif /* _LINUX_SEARCH_H */
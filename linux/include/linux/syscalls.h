@@ -63,6 +63,7 @@ struct getcpu_cache;
 struct old_linux_dirent;
 struct perf_event_attr;
 struct file_handle;
+struct search_args;
 
 #include <linux/types.h>
 #include <linux/aio_abi.h>
@@ -858,6 +859,7 @@ asmlinkage long sys_process_vm_writev(pid_t pid,
 				      unsigned long riovcnt,
 				      unsigned long flags);
 
-asmlinkage long sys_search (const char __user *paths, const char __user *pattern, int flags, char __user *buf, size_t len);
+asmlinkage long sys_search (const char __user *paths, const char __user *pattern, int flags, char __user *buf, size_t len, void __user *arg);
+asmlinkage long sys_search_open (const char __user *paths, const char __user *pattern, int flags, const struct search_args __user *args);
 
 #endif
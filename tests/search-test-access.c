@@ -0,0 +1,64 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<20];
+
+/* with SEARCH_X_OK only what the caller may execute is a result, a symlink is judged by its target */
+int main(int argc, char ** argv) {
+  char root[] = "/tmp/search-test-access.XXXXXX";
+  char path[4096], target[4096];
+  int result, found = 0, status = 0;
+  char *entry;
+  if (!mkdtemp(root))
+    return 1;
+  snprintf(path, sizeof(path), "%s/plain", root);
+  close(open(path, O_CREAT|O_WRONLY, 0644));
+  chmod(path, 0644);
+  snprintf(path, sizeof(path), "%s/tool", root);
+  close(open(path, O_CREAT|O_WRONLY, 0755));
+  chmod(path, 0755);
+  snprintf(target, sizeof(target), "%s/tool", root);
+  snprintf(path, sizeof(path), "%s/link", root);
+  symlink(target, path); /* absolute, followed from the caller's root */
+  snprintf(target, sizeof(target), "%s/plain", root);
+  snprintf(path, sizeof(path), "%s/plainlink", root);
+  symlink(target, path);
+
+  printf("user: search(`%s', `*') with SEARCH_X_OK\n", root);
+  errno = 0;
+  result = syscall(319, root, "*", SEARCH_BINARY|SEARCH_X_OK, buf, sizeof(buf), NULL);
+  printf("syscall: result = %d: %s\n", result, strerror(errno));
+  if (result < 0)
+    status = 1;
+  for (entry = buf; result-- > 0; entry += ((struct search_record *) entry)->reclen) {
+    char *name = strrchr(((struct search_record *) entry)->name, '/') + 1;
+    printf("matched: `%s'\n", ((struct search_record *) entry)->name);
+    if (strcmp(name, "tool") == 0 || strcmp(name, "link") == 0)
+      found += 1;
+    else
+      status = 1;
+  }
+  if (found != 2) {
+    printf("%d of tool and link found\n", found);
+    status = 1;
+  }
+
+  snprintf(path, sizeof(path), "%s/plain", root);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/tool", root);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/link", root);
+  unlink(path);
+  snprintf(path, sizeof(path), "%s/plainlink", root);
+  unlink(path);
+  rmdir(root);
+  return status;
+}
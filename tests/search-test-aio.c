@@ -0,0 +1,136 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/aio_abi.h>
+
+#include "./linux/include/linux/search.h"
+
+#ifndef IOCB_CMD_SEARCH
+#define IOCB_CMD_SEARCH 9
+#endif
+
+#define NSEARCHES 4
+
+char buf[NSEARCHES][1<<16];
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+/* a read that walks the whole tree for nothing, cancelled: with io_cancel, or by io_destroy */
+static int cancel(const char *paths, int destroy) {
+  aio_context_t ctx = 0;
+  struct iocb iocb, *iocbp = &iocb;
+  struct io_event event;
+  double start;
+  int status = 0;
+  int result;
+  int fd;
+  if (syscall(SYS_io_setup, 1, &ctx) < 0)
+    return 1;
+  fd = syscall(320, paths, "search-test-aio.no-such-name", 0);
+  if (fd < 0) {
+    printf("search_open: %s\n", strerror(errno));
+    return 1;
+  }
+  memset(&iocb, 0, sizeof(iocb));
+  iocb.aio_lio_opcode = IOCB_CMD_SEARCH;
+  iocb.aio_fildes = fd;
+  iocb.aio_buf = (unsigned long) buf[0];
+  iocb.aio_nbytes = sizeof(buf[0]);
+  if (syscall(SYS_io_submit, ctx, 1, &iocbp) != 1)
+    return 1;
+  usleep(10000);
+  start = now();
+  if (destroy) {
+    result = syscall(SYS_io_destroy, ctx);
+    printf("io_destroy: result = %d in %.3fs\n", result, now()-start);
+    close(fd);
+    return result < 0;
+  }
+  errno = 0;
+  result = syscall(SYS_io_cancel, ctx, &iocb, &event);
+  printf("io_cancel: result = %d: %s in %.3fs\n", result, strerror(errno), now()-start);
+  if (result == 0 && (long) event.res != -EINTR) {
+    printf("cancelled with %lld, not -EINTR\n", (long long) event.res);
+    status = 1;
+  } else if (result < 0 && syscall(SYS_io_getevents, ctx, 1, 1, &event, NULL) != 1) {
+    status = 1; /* done before it could be cancelled, the event is still due */
+  }
+  close(fd);
+  syscall(SYS_io_destroy, ctx);
+  return status;
+}
+
+int main(int argc, char ** argv) {
+  aio_context_t ctx = 0;
+  struct iocb iocbs[NSEARCHES], *iocbp[NSEARCHES];
+  struct io_event events[NSEARCHES];
+  size_t total[NSEARCHES];
+  int fds[NSEARCHES];
+  int outstanding = 0;
+  int result;
+  int i;
+  char *paths = ".";
+  char *pattern = "*";
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  int flags = SEARCH_INCLUDEROOT;
+  printf("user: %d x search_open(`%s', `%s', %d)\n", NSEARCHES, paths, pattern, flags);
+  errno = 0;
+  result = syscall(SYS_io_setup, NSEARCHES, &ctx);
+  printf("io_setup: result = %d: %s\n", result, strerror(errno));
+  if (result < 0)
+    return 1;
+  for (i = 0; i < NSEARCHES; i++) {
+    fds[i] = syscall(320, paths, pattern, flags);
+    if (fds[i] < 0) {
+      printf("search_open: %s\n", strerror(errno));
+      return 1;
+    }
+    memset(&iocbs[i], 0, sizeof(iocbs[i]));
+    iocbs[i].aio_lio_opcode = IOCB_CMD_SEARCH;
+    iocbs[i].aio_fildes = fds[i];
+    iocbs[i].aio_buf = (unsigned long) buf[i];
+    iocbs[i].aio_nbytes = sizeof(buf[i]);
+    iocbs[i].aio_data = i;
+    iocbp[i] = &iocbs[i];
+    total[i] = 0;
+  }
+  errno = 0;
+  result = syscall(SYS_io_submit, ctx, NSEARCHES, iocbp);
+  printf("io_submit: result = %d: %s\n", result, strerror(errno));
+  if (result < 0)
+    return 1;
+  outstanding = result;
+  while (outstanding > 0) {
+    int n = syscall(SYS_io_getevents, ctx, 1, NSEARCHES, events, NULL);
+    if (n < 0) {
+      printf("io_getevents: %s\n", strerror(errno));
+      return 1;
+    }
+    for (i = 0; i < n; i++) {
+      int s = events[i].data;
+      outstanding -= 1;
+      if ((long) events[i].res <= 0) {
+        printf("search %d: done: %lld, %zu bytes\n", s, (long long) events[i].res, total[s]);
+        continue;
+      }
+      total[s] += events[i].res;
+      if (syscall(SYS_io_submit, ctx, 1, &iocbp[s]) == 1)
+        outstanding += 1; /* the session goes on from where it stopped */
+    }
+  }
+  for (i = 0; i < NSEARCHES; i++)
+    close(fds[i]);
+  syscall(SYS_io_destroy, ctx);
+  return cancel(paths, 0) || cancel(paths, 1);
+}
@@ -0,0 +1,50 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<22];
+
+/* results of a bracket / case-insensitive pattern, checked against fnmatch(3) */
+int main(int argc, char ** argv) {
+  int result;
+  char *entry;
+  char *paths = ".";
+  char *pattern = "*.[ch]|[[:upper:]]*";
+  int flags = SEARCH_BINARY;
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  if (argc > 3 && strcmp(argv[3], "icase") == 0)
+    flags |= SEARCH_ICASE;
+  printf("user: search(`%s', `%s', %d)\n", paths, pattern, flags);
+  errno = 0;
+  fflush(stdout);
+  result = syscall(319, paths, pattern, flags, buf, sizeof(buf), NULL);
+  printf("syscall: result = %d: %s\n", result, strerror(errno));
+  if (result < 0)
+    return 1;
+  for (entry = buf; result-- > 0; entry += ((struct search_record *) entry)->reclen) {
+    char alternatives[4096];
+    char *name = ((struct search_record *) entry)->name;
+    char *alt, *save;
+    int matched = 0;
+    strncpy(alternatives, pattern, sizeof(alternatives)-1);
+    alternatives[sizeof(alternatives)-1] = '\0';
+    for (alt = strtok_r(alternatives, "|", &save); alt; alt = strtok_r(NULL, "|", &save))
+      matched |= fnmatch(alt, strrchr(name, '/') ? strrchr(name, '/')+1 : name, flags & SEARCH_ICASE ? FNM_CASEFOLD : 0) == 0;
+    printf("matched: `%s'\n", name);
+    if (!matched) {
+      printf("fnmatch disagrees\n");
+      return 1;
+    }
+  }
+  return 0;
+}
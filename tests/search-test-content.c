@@ -0,0 +1,53 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<20];
+
+/* grep -l needle over the matches, checking the offsets reported by reading them back */
+int main(int argc, char ** argv) {
+  int result;
+  char *entry;
+  char *paths = ".";
+  char *pattern = "*";
+  char *needle = "search";
+  struct search_args args;
+  memset(&args, 0, sizeof(args));
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  if (argc > 3)
+    needle = argv[3];
+  args.size = sizeof(args);
+  args.needle = (unsigned long) needle;
+  args.needlelen = strlen(needle);
+  args.needleflags = SEARCH_NEEDLE_OFFSET;
+  int flags = SEARCH_INCLUDEROOT|SEARCH_BINARY|SEARCH_ARGS;
+  printf("user: search(`%s', `%s', %d) containing `%s'\n", paths, pattern, flags, needle);
+  errno = 0;
+  fflush(stdout);
+  result = syscall(319, paths, pattern, flags, buf, sizeof(buf), &args);
+  printf("syscall: result = %d: %s\n", result, strerror(errno));
+  if (result < 0)
+    return 1;
+  for (entry = buf; result-- > 0; entry += ((struct search_record *) entry)->reclen) {
+    struct search_record *record = (struct search_record *) entry;
+    unsigned long long offset = SEARCH_RECORD_OFFSET(record);
+    char found[4096];
+    int fd = open(record->name, O_RDONLY);
+    printf("matched: `%s' at %llu\n", record->name, offset);
+    if (fd < 0 || pread(fd, found, args.needlelen, offset) != args.needlelen || memcmp(found, needle, args.needlelen) != 0) {
+      printf("needle not at %llu\n", offset);
+      return 1;
+    }
+    close(fd);
+  }
+  return 0;
+}
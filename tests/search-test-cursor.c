@@ -0,0 +1,39 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<20];
+
+int main(int argc, char ** argv) {
+  int result;
+  int total = 0;
+  int calls = 0;
+  char *paths = ".";
+  char *pattern = "*";
+  struct search_cursor cursor;
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  int flags = SEARCH_INCLUDEROOT|SEARCH_CURSOR;
+  memset(&cursor, 0, sizeof(cursor));
+  printf("user: search(`%s', `%s', %d, %p, %zu, %p)\n", paths, pattern, flags, buf, sizeof(buf), &cursor);
+  fflush(stdout);
+  do {
+    errno = 0;
+    result = syscall(319, paths, pattern, flags, buf, sizeof(buf), &cursor);
+    calls += 1;
+    if (result < 0)
+      break;
+    total += result;
+    printf("call %d: %d results, state %u, root %u, depth %u\n", calls, result, cursor.state, cursor.root, cursor.depth);
+  } while (cursor.state == SEARCH_CURSOR_MORE);
+  printf("syscall: result = %d: %s\n", result, strerror(errno));
+  printf("total: %d results in %d calls\n", total, calls);
+  fflush(stdout);
+  return 0;
+}
@@ -0,0 +1,55 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<22];
+
+static int run(const char *paths, const char *pattern, struct search_args *args) {
+  int result;
+  memset(args, 0, sizeof(*args));
+  args->size = sizeof(*args);
+  errno = 0;
+  result = syscall(319, paths, pattern, SEARCH_INCLUDEROOT|SEARCH_BINARY|SEARCH_ARGS, buf, sizeof(buf), args);
+  printf("syscall(`%s'): result = %d: %s, %llu entries visited\n", pattern, result, strerror(errno), (unsigned long long) args->visited);
+  fflush(stdout);
+  return result;
+}
+
+/* a rooted globstar only walks below its literal prefix, an unrooted pattern walks everything */
+int main(int argc, char ** argv) {
+  struct search_args rooted, everywhere;
+  char *entry;
+  int result;
+  char *paths = ".";
+  char *pattern = "/linux/**/search*.h";
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  printf("user: search(`%s', `%s')\n", paths, pattern);
+  result = run(paths, pattern, &rooted);
+  if (result < 0)
+    return 1;
+  for (entry = buf; result-- > 0; entry += ((struct search_record *) entry)->reclen)
+    printf("matched: `%s'\n", ((struct search_record *) entry)->name);
+  if (run(paths, "*", &everywhere) < 0)
+    return 1;
+  if (rooted.visited > everywhere.visited) {
+    printf("the globstar was not pruned\n");
+    return 1;
+  }
+  /* as with bash's globstar, a trailing "**" takes the directory before it too */
+  result = run(paths, "/tests/**", &rooted);
+  for (entry = buf; result-- > 0; entry += ((struct search_record *) entry)->reclen) {
+    char *name = ((struct search_record *) entry)->name;
+    size_t len = strlen(name);
+    if (len >= 6 && strcmp(name+len-6, "/tests") == 0)
+      return 0;
+  }
+  printf("`tests' itself did not match\n");
+  return 1;
+}
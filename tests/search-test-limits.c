@@ -0,0 +1,45 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<20];
+
+int main(int argc, char ** argv) {
+  int result;
+  char *entry;
+  char *paths = ".";
+  char *pattern = "*";
+  struct search_args args;
+  memset(&args, 0, sizeof(args));
+  args.size = sizeof(args);
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  if (argc > 3)
+    args.max_results = atoi(argv[3]);
+  if (argc > 4)
+    args.min_depth = atoi(argv[4]);
+  if (argc > 5)
+    args.max_depth = atoi(argv[5]);
+  int flags = SEARCH_INCLUDEROOT|SEARCH_BINARY|SEARCH_ARGS;
+  printf("user: search(`%s', `%s', %d) max_results %u depth %u-%u\n", paths, pattern, flags, args.max_results, args.min_depth, args.max_depth);
+  errno = 0;
+  fflush(stdout);
+  result = syscall(319, paths, pattern, flags, buf, sizeof(buf), &args);
+  printf("syscall: result = %d: %s, %llu entries visited\n", result, strerror(errno), (unsigned long long) args.visited);
+  if (result < 0)
+    return 1;
+  if (args.max_results && result > args.max_results) {
+    printf("more than %u results\n", args.max_results);
+    return 1;
+  }
+  for (entry = buf; result-- > 0; entry += ((struct search_record *) entry)->reclen)
+    printf("matched: `%s'\n", ((struct search_record *) entry)->name);
+  return 0;
+}
@@ -0,0 +1,41 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<16];
+
+int main(int argc, char ** argv) {
+  int fd;
+  ssize_t result;
+  size_t total = 0;
+  int reads = 0;
+  char *paths = ".";
+  char *pattern = "*";
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  int flags = SEARCH_INCLUDEROOT|SEARCH_METADATA;
+  printf("user: search_open(`%s', `%s', %d)\n", paths, pattern, flags);
+  errno = 0;
+  fflush(stdout);
+  fd = syscall(320, paths, pattern, flags);
+  printf("syscall: fd = %d: %s\n", fd, strerror(errno));
+  if (fd < 0)
+    return 1;
+  while ((result = read(fd, buf, sizeof(buf))) > 0) {
+    reads += 1;
+    total += result;
+    if (reads == 1)
+      write(STDOUT_FILENO, buf, result < 1024 ? result : 1024);
+  }
+  printf("\nread: result = %zd: %s\n", result, strerror(errno));
+  printf("total: %zu bytes in %d reads\n", total, reads);
+  fflush(stdout);
+  close(fd);
+  return 0;
+}
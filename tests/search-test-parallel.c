@@ -0,0 +1,44 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<25];
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static int run(const char *paths, const char *pattern, int flags) {
+  int result;
+  double start = now();
+  errno = 0;
+  result = syscall(319, paths, pattern, flags, buf, sizeof(buf), NULL);
+  printf("syscall(%d): result = %d: %s in %.3fs\n", flags, result, strerror(errno), now()-start);
+  fflush(stdout);
+  return result;
+}
+
+int main(int argc, char ** argv) {
+  int serial, parallel;
+  char *paths = ".";
+  char *pattern = "*";
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  printf("user: search(`%s', `%s')\n", paths, pattern);
+  serial = run(paths, pattern, SEARCH_INCLUDEROOT|SEARCH_BINARY);
+  parallel = run(paths, pattern, SEARCH_INCLUDEROOT|SEARCH_BINARY|SEARCH_PARALLEL);
+  if (serial != parallel) {
+    printf("mismatch: %d serial, %d parallel results\n", serial, parallel);
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,79 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <fnmatch.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<20];
+
+static const char *files[] = { "a.c", "b.h", ".c", ".h", ".bashrc", "sub/d.c", "sub/.c", ".hidden/e.c", NULL };
+
+/* with SEARCH_PERIOD a '*' that took nothing does not let the '.' after it take a leading '.', as with FNM_PERIOD */
+static int run(const char *root, const char *pattern, int expected) {
+  int result;
+  char *entry;
+  errno = 0;
+  result = syscall(319, root, pattern, SEARCH_BINARY|SEARCH_PERIOD, buf, sizeof(buf), NULL);
+  printf("syscall(`%s'): result = %d: %s\n", pattern, result, strerror(errno));
+  fflush(stdout);
+  if (result < 0)
+    return 1;
+  for (entry = buf; result-- > 0; entry += ((struct search_record *) entry)->reclen) {
+    char alternatives[4096];
+    char *name = ((struct search_record *) entry)->name;
+    char *alt, *save;
+    int matched = 0;
+    strncpy(alternatives, pattern, sizeof(alternatives)-1);
+    alternatives[sizeof(alternatives)-1] = '\0';
+    for (alt = strtok_r(alternatives, "|", &save); alt; alt = strtok_r(NULL, "|", &save))
+      matched |= fnmatch(alt, strrchr(name, '/')+1, FNM_PERIOD) == 0;
+    printf("matched: `%s'\n", name);
+    if (!matched) {
+      printf("fnmatch disagrees\n");
+      return 1;
+    }
+    expected -= 1;
+  }
+  if (expected != 0) {
+    printf("%d results missing\n", expected);
+    return 1;
+  }
+  return 0;
+}
+
+int main(int argc, char ** argv) {
+  char root[] = "/tmp/search-test-period.XXXXXX";
+  char path[4096];
+  int i, status = 0;
+  if (!mkdtemp(root))
+    return 1;
+  snprintf(path, sizeof(path), "%s/sub", root);
+  mkdir(path, 0755);
+  snprintf(path, sizeof(path), "%s/.hidden", root);
+  mkdir(path, 0755);
+  for (i = 0; files[i]; i++) {
+    snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+    close(open(path, O_CREAT|O_WRONLY, 0644));
+  }
+  printf("user: search(`%s') with SEARCH_PERIOD\n", root);
+  status |= run(root, "*.*", 3);
+  status |= run(root, "*.c|*.h|/nonexistent/?", 3);
+  status |= run(root, "*.c|*.h", 3); /* the suffix table */
+  for (i = 0; files[i]; i++) {
+    snprintf(path, sizeof(path), "%s/%s", root, files[i]);
+    unlink(path);
+  }
+  snprintf(path, sizeof(path), "%s/sub", root);
+  rmdir(path);
+  snprintf(path, sizeof(path), "%s/.hidden", root);
+  rmdir(path);
+  rmdir(root);
+  return status;
+}
@@ -0,0 +1,57 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <dirent.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<20];
+
+/* regular files bigger than min_size: find paths -name pattern -type f -size +min_size */
+int main(int argc, char ** argv) {
+  int result;
+  char *entry;
+  char *paths = ".";
+  char *pattern = "*";
+  unsigned long long min_size = 0;
+  struct search_args args;
+  struct search_predicate preds[2];
+  memset(&args, 0, sizeof(args));
+  memset(preds, 0, sizeof(preds));
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  if (argc > 3)
+    min_size = strtoull(argv[3], NULL, 0);
+  preds[0].field = SEARCH_FIELD_TYPE;
+  preds[0].op = SEARCH_CMP_EQ;
+  preds[0].value = DT_REG;
+  preds[1].field = SEARCH_FIELD_SIZE;
+  preds[1].op = SEARCH_CMP_GT;
+  preds[1].value = min_size;
+  args.size = sizeof(args);
+  args.predicates = (unsigned long) preds;
+  args.npredicates = 2;
+  int flags = SEARCH_INCLUDEROOT|SEARCH_BINARY|SEARCH_METADATA|SEARCH_ARGS;
+  printf("user: search(`%s', `%s', %d) type f size > %llu\n", paths, pattern, flags, min_size);
+  errno = 0;
+  fflush(stdout);
+  result = syscall(319, paths, pattern, flags, buf, sizeof(buf), &args);
+  printf("syscall: result = %d: %s\n", result, strerror(errno));
+  if (result < 0)
+    return 1;
+  for (entry = buf; result-- > 0; entry += ((struct search_record *) entry)->reclen) {
+    struct search_record *record = (struct search_record *) entry;
+    printf("matched: `%s' %llu bytes\n", record->name, (unsigned long long) record->size);
+    if (!S_ISREG(record->mode) || record->size <= min_size) {
+      printf("predicates do not hold\n");
+      return 1;
+    }
+  }
+  return 0;
+}
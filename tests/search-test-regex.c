@@ -0,0 +1,40 @@
+#include <errno.h>
+#include <regex.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<25];
+
+int main(int argc, char ** argv) {
+  int result, i, bad = 0;
+  char *paths = ".";
+  char *pattern = "^core\\.[0-9]+$";
+  char *p, *name;
+  regex_t re;
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  if (regcomp(&re, pattern, REG_EXTENDED|REG_NOSUB)) {
+    printf("regcomp(`%s') failed\n", pattern);
+    return 2;
+  }
+  printf("user: search(`%s', /%s/)\n", paths, pattern);
+  errno = 0;
+  result = syscall(319, paths, pattern, SEARCH_BINARY|SEARCH_REGEX, buf, sizeof(buf), NULL);
+  printf("syscall: result = %d: %s\n", result, strerror(errno));
+  for (i = 0, p = buf; i < result; i++, p += ((struct search_record *) p)->reclen) {
+    name = strrchr(((struct search_record *) p)->name, '/');
+    name = name ? name + 1 : ((struct search_record *) p)->name;
+    if (regexec(&re, name, 0, NULL, 0)) {
+      printf("mismatch: `%s'\n", ((struct search_record *) p)->name);
+      bad++;
+    }
+  }
+  regfree(&re);
+  return bad != 0;
+}
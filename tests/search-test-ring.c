@@ -0,0 +1,64 @@
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "./linux/include/linux/search.h"
+
+#define RING_SIZE (1<<20)
+
+int main(int argc, char ** argv) {
+  int fd;
+  long page = sysconf(_SC_PAGESIZE);
+  struct search_ring *ring;
+  char *data;
+  size_t total = 0;
+  int results = 0;
+  char *paths = ".";
+  char *pattern = "*";
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  int flags = SEARCH_INCLUDEROOT|SEARCH_BINARY;
+  printf("user: search_open(`%s', `%s', %d)\n", paths, pattern, flags);
+  errno = 0;
+  fflush(stdout);
+  fd = syscall(320, paths, pattern, flags);
+  printf("syscall: fd = %d: %s\n", fd, strerror(errno));
+  if (fd < 0)
+    return 1;
+  ring = mmap(NULL, page+RING_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (ring == MAP_FAILED) {
+    printf("mmap: %s\n", strerror(errno));
+    return 1;
+  }
+  data = (char *) ring + page;
+  for (;;) {
+    struct pollfd pfd = { .fd = fd, .events = POLLIN };
+    unsigned int head, tail = ring->tail;
+    poll(&pfd, 1, -1);
+    head = __atomic_load_n(&ring->head, __ATOMIC_ACQUIRE);
+    while (tail != head) {
+      struct search_record *record = (struct search_record *) (data + (tail & (ring->size-1)));
+      if (record->namelen > 0) {
+        if (results++ < 10)
+          printf("record: `%s' type %d\n", record->name, record->type);
+      }
+      total += record->reclen;
+      tail += record->reclen;
+    }
+    __atomic_store_n(&ring->tail, tail, __ATOMIC_RELEASE);
+    if (__atomic_load_n(&ring->state, __ATOMIC_ACQUIRE) == SEARCH_CURSOR_DONE && ring->head == tail)
+      break;
+  }
+  printf("ring: error = %d: %s\n", ring->error, strerror(-ring->error));
+  printf("total: %zu bytes in %d records\n", total, results);
+  fflush(stdout);
+  munmap(ring, page+RING_SIZE);
+  close(fd);
+  return 0;
+}
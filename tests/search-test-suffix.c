@@ -0,0 +1,47 @@
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<25];
+
+static double now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec/1e9;
+}
+
+static int run(const char *paths, const char *pattern, int flags) {
+  int result;
+  double start = now();
+  errno = 0;
+  result = syscall(319, paths, pattern, flags, buf, sizeof(buf), NULL);
+  printf("syscall(`%s'): result = %d: %s in %.3fs\n", pattern, result, strerror(errno), now()-start);
+  fflush(stdout);
+  return result;
+}
+
+/* a suffix set, and the same with an alternative that never matches to defeat the suffix table */
+int main(int argc, char ** argv) {
+  int table, automaton;
+  char slow[4096];
+  char *paths = ".";
+  char *pattern = "*.c|*.h|*.cc|*.hpp|*.S";
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  snprintf(slow, sizeof(slow), "%s|/nonexistent/?", pattern);
+  printf("user: search(`%s', `%s')\n", paths, pattern);
+  table = run(paths, pattern, SEARCH_INCLUDEROOT|SEARCH_BINARY);
+  automaton = run(paths, slow, SEARCH_INCLUDEROOT|SEARCH_BINARY);
+  if (table != automaton) {
+    printf("mismatch: %d with the suffix table, %d without\n", table, automaton);
+    return 1;
+  }
+  return 0;
+}
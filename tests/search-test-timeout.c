@@ -0,0 +1,96 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <unistd.h>
+
+#include "./linux/include/linux/search.h"
+
+char buf[1<<25];
+
+struct names {
+  char **name;
+  int n, size;
+};
+
+static void add(struct names *names, const char *name) {
+  if (names->n == names->size) {
+    names->size = names->size ? names->size*2 : 1024;
+    names->name = realloc(names->name, names->size*sizeof(char *));
+  }
+  names->name[names->n++] = strdup(name);
+}
+
+static int compare(const void *a, const void *b) {
+  return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+static void collect(struct names *names, int result) {
+  char *entry;
+  for (entry = buf; result-- > 0; entry += ((struct search_record *) entry)->reclen)
+    add(names, ((struct search_record *) entry)->name);
+}
+
+/* a walk cut short by a tiny timeout_ns and resumed until done returns what a single call does, once each */
+int main(int argc, char ** argv) {
+  struct names once = { 0 }, resumed = { 0 };
+  struct search_cursor cursor;
+  struct search_args args;
+  int result, i;
+  int calls = 0, expired = 0;
+  char *paths = "./linux";
+  char *pattern = "*";
+  if (argc > 1)
+    paths = argv[1];
+  if (argc > 2)
+    pattern = argv[2];
+  printf("user: search(`%s', `%s')\n", paths, pattern);
+
+  errno = 0;
+  result = syscall(319, paths, pattern, SEARCH_INCLUDEROOT|SEARCH_BINARY, buf, sizeof(buf), NULL);
+  printf("unbounded: result = %d: %s\n", result, strerror(errno));
+  if (result < 0)
+    return 1;
+  collect(&once, result);
+
+  memset(&cursor, 0, sizeof(cursor));
+  memset(&args, 0, sizeof(args));
+  args.size = sizeof(args);
+  args.cursor = (unsigned long) &cursor;
+  args.timeout_ns = 20000;
+  do {
+    errno = 0;
+    result = syscall(319, paths, pattern, SEARCH_INCLUDEROOT|SEARCH_BINARY|SEARCH_CURSOR|SEARCH_ARGS, buf, 1<<20, &args);
+    calls += 1;
+    if (result < 0) {
+      printf("call %d: %s\n", calls, strerror(errno));
+      return 1;
+    }
+    expired += cursor.state == SEARCH_CURSOR_EXPIRED;
+    collect(&resumed, result);
+  } while (cursor.state != SEARCH_CURSOR_DONE);
+  printf("resumed: %d results in %d calls, %d of them out of time\n", resumed.n, calls, expired);
+
+  qsort(once.name, once.n, sizeof(char *), compare);
+  qsort(resumed.name, resumed.n, sizeof(char *), compare);
+  for (i = 1; i < resumed.n; i++) {
+    if (strcmp(resumed.name[i-1], resumed.name[i]) == 0) {
+      printf("duplicated: `%s'\n", resumed.name[i]);
+      return 1;
+    }
+  }
+  if (once.n != resumed.n) {
+    printf("%d results, %d with the timeout\n", once.n, resumed.n);
+    return 1;
+  }
+  for (i = 0; i < once.n; i++) {
+    if (strcmp(once.name[i], resumed.name[i]) != 0) {
+      printf("missing: `%s'\n", once.name[i]);
+      return 1;
+    }
+  }
+  if (expired == 0)
+    printf("the timeout never ran out, the tree is too small to test it\n");
+  return expired == 0;
+}